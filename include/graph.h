@@ -0,0 +1,147 @@
+#pragma once
+
+#include <ngui.h>
+#include <spatial.h>
+#include <cstdint>
+
+namespace ng::ui
+{
+
+/**
+ * Node graph drawn straight onto the renderer rather than as widgets, so it
+ * stays fast with tens of thousands of nodes. Nodes and edges are kept as
+ * parallel arrays indexed by id, and both are in a SpatialGrid in graph
+ * coordinates so a frame only looks at what's in view.
+ *
+ * The view pans by dragging empty space and zooms around the pointer with the
+ * wheel. Dragging a node moves it. Edges are bezier curves, whose
+ * tessellations the renderer caches, so only the edges of a node that moved
+ * are tessellated again. Below "detailZoom" nodes are drawn as flat boxes and
+ * edges as straight hairlines, with edges too short to see skipped.
+ */
+class GraphCanvas : public Widget
+{
+public:
+	using NodeId = uint32_t;
+	using EdgeId = uint32_t;
+
+	static constexpr NodeId noNode = UINT32_MAX;
+
+	GraphCanvas();
+
+	void render(Box boundingBox, Renderer &renderer) override;
+
+	// Ids count up from 0 in the order things are added
+	NodeId addNode(float x, float y, float w, float h, Color color = Color(70, 90, 120));
+	EdgeId addEdge(NodeId from, NodeId to, Color color = Color(160, 160, 160));
+	void moveNode(NodeId node, float x, float y);
+
+	void reserve(size_t nodes, size_t edges);
+	void clear();
+
+	size_t nodeCount() const
+	{
+		return nodes.x.size();
+	}
+
+	size_t edgeCount() const
+	{
+		return edges.from.size();
+	}
+
+	// Top left of node, in graph coordinates
+	float nodeX(NodeId node) const
+	{
+		return nodes.x[node];
+	}
+
+	float nodeY(NodeId node) const
+	{
+		return nodes.y[node];
+	}
+
+	// Graph point (x, y) ends up at the widget's top left
+	void setView(float x, float y, float zoom);
+	// By dx, dy on screen
+	void pan(int dx, int dy);
+	// Scales the view by factor, keeping the graph point under local in place
+	void zoomAt(Point local, float factor);
+
+	float getZoom() const
+	{
+		return zoom;
+	}
+
+	// Between graph coordinates and coordinates local to the widget
+	Point toLocal(float x, float y) const;
+	void toGraph(Point local, float &x, float &y) const;
+
+	// Topmost node under local, or noNode
+	NodeId nodeAt(Point local) const;
+
+	// What the last frame drew
+	size_t drawnNodes() const
+	{
+		return shownNodes;
+	}
+
+	size_t drawnEdges() const
+	{
+		return shownEdges;
+	}
+
+protected:
+	void propertyChanged(const std::string &key, Property &prop) override;
+	bool mouseEvent(const MouseEvent &event) override;
+
+private:
+	struct Nodes
+	{
+		std::vector<float> x, y, w, h;
+		std::vector<Color> color;
+		// Edges starting or ending at each node
+		std::vector<std::vector<EdgeId>> incident;
+	} nodes;
+
+	struct Edges
+	{
+		std::vector<NodeId> from, to;
+		std::vector<Color> color;
+		// As last put in edgeGrid
+		std::vector<Box> bounds;
+	} edges;
+
+	SpatialGrid<NodeId> nodeGrid;
+	SpatialGrid<EdgeId> edgeGrid;
+
+	float viewX = 0;
+	float viewY = 0;
+	float zoom = 1;
+	float detailZoom = 0.5f;
+
+	enum class Drag
+	{
+		None,
+		View,
+		Node,
+	};
+
+	Drag drag = Drag::None;
+	NodeId dragged = noNode;
+	Point lastPointer = {0, 0};
+	// Where in the dragged node it was picked up, in graph coordinates
+	float grabX = 0;
+	float grabY = 0;
+
+	// Scratch space reused between frames
+	std::vector<NodeId> visible;
+	size_t shownNodes = 0;
+	size_t shownEdges = 0;
+
+	Box nodeBounds(NodeId node) const;
+	Box edgeBounds(EdgeId edge) const;
+	// Leaves the right side of from and enters the left side of to, both level
+	Bezier edgeCurve(EdgeId edge) const;
+};
+
+}
@@ -5,17 +5,57 @@
 namespace ng::ui
 {
 
+/**
+ * Shows the image at the path in its src property, scaled to fit. Rather
+ * than uploading the whole file and scaling it every frame, the image is
+ * decoded on the worker pool and filtered down to the size it's drawn at,
+ * already premultiplied, so a texture is never bigger than the widget on
+ * screen. Layout is in output pixels, so that's the display's density too.
+ * Variants are kept in the renderer's texture cache by path and size.
+ *
+ * Nothing is decoded until the image is first drawn. A placeholder is drawn
+ * until then. After a resize the old variant is stretched until the size has
+ * held still for a couple of frames and the new one is ready, and the last
+ * few files decoded are kept at full size so a resize only filters again.
+ */
 class Image : public Widget
 {
 public:
-	Image() : Widget()
-	{}
+	Image();
+	~Image() override;
 
 	virtual void render(Box boundingBox, Renderer &renderer) override;
 
+	// Size the current texture was made for, before any clamping to the source
+	Size variantSize() const
+	{
+		return shown;
+	}
+
+	struct Decode;
+
 private:
-	bool textureLoaded = false;
+	std::string src;
 	Texture texture;
+	Size shown = {0, 0};
+	// Renderer::textureGeneration() texture was made in
+	unsigned generation = 0;
+	// Shared with every other Image waiting on the same file at the same size
+	std::shared_ptr<Decode> decode;
+	// src couldn't be loaded, don't keep trying
+	bool failed = false;
+	// Size being resized to, and for how many frames it's held still
+	Size settling = {0, 0};
+	unsigned settledFrames = 0;
+	// Lets a check queued for the next frame tell this is gone
+	std::shared_ptr<Image *> self;
+
+	void load(std::string path);
+	// Starts on a variant for size unless one is cached or on its way
+	void request(Size size, Renderer &renderer);
+	void cancel();
+	// Whether size has held still long enough to be worth a new variant
+	bool settled(Size size);
 };
 
 }
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <ngui.h>
+
+namespace ng::ui
+{
+
+/**
+ * Scrolling list, or grid with the "columns" property, of any number of items
+ * where only the ones in view exist as widgets. Items are made by a factory
+ * and filled in by a binder, and the widgets that scroll out are kept and
+ * bound again to whatever scrolls in, so memory and frame time depend on the
+ * viewport rather than the item count.
+ *
+ * Rows are "rowHeight" tall unless given their own height. Those are kept as
+ * a Fenwick tree, so finding the row at a scroll position or changing one
+ * height is O(log n) however many rows there are.
+ */
+class VirtualList : public Widget
+{
+public:
+	// Makes an item widget, from arena if there is one. constructWidget<T> will do.
+	using ItemFactory = std::function<Widget *(WidgetArena *arena)>;
+	// Fills item in for the item at index, maybe after it showed another one
+	using ItemBinder = std::function<void (Widget &item, size_t index)>;
+
+	VirtualList();
+	~VirtualList() override;
+
+	/**
+	 * Replaces everything shown so far. The widgets already made are kept to
+	 * be bound again if create is the same function as before, otherwise
+	 * they're destroyed.
+	 */
+	void setItems(size_t count, ItemFactory create, ItemBinder bind);
+	// Like setItems() with the same factory, for factories that can't be compared
+	void setItems(size_t count, ItemBinder bind);
+
+	// Items already shown keep their widgets if they're still there
+	void setCount(size_t count);
+
+	size_t getCount() const
+	{
+		return count;
+	}
+
+	// Binds the shown items again after the data behind them changed
+	void refresh();
+	void refresh(size_t index);
+
+	void setRowHeight(size_t row, int height);
+	int getRowHeight(size_t row) const;
+
+	// Top of row, from the top of the first one
+	int rowOffset(size_t row) const;
+	// Row at y, from the top of the first one
+	size_t rowAt(int y) const;
+
+	int contentHeight() const
+	{
+		return rowOffset(rows());
+	}
+
+	// Clamped so the last row doesn't scroll past the bottom
+	void scrollTo(int y);
+	void scrollToRow(size_t row);
+
+	int getScroll() const
+	{
+		return scroll;
+	}
+
+	// Widgets that currently exist for items, shown or not
+	size_t itemWidgets() const
+	{
+		return shown.size() + spare.size();
+	}
+
+protected:
+	Size measureContent(Size available) override;
+	void arrangeContent(Size size) override;
+	void propertyChanged(const std::string &key, Property &prop) override;
+	bool mouseEvent(const MouseEvent &event) override;
+
+private:
+	struct Shown
+	{
+		size_t index;
+		Widget *widget;
+	};
+
+	ItemFactory create;
+	ItemBinder bind;
+	size_t count = 0;
+	int rowHeight = 24;
+	int columns = 1;
+	int scroll = 0;
+	Size viewport = {0, 0};
+
+	// How much taller than rowHeight each row is, as a Fenwick tree indexed
+	// from 1. Empty for as long as every row is rowHeight.
+	std::vector<int> extra;
+
+	std::vector<Shown> shown;
+	// Scrolled out, waiting to be bound to something else
+	std::vector<Widget *> spare;
+
+	size_t rows() const
+	{
+		return (count + columns - 1) / columns;
+	}
+
+	// Sum of extra over the first n rows
+	int extraBefore(size_t n) const;
+	void resizeRows(size_t before);
+	// Makes, recycles and positions item widgets for what's in the viewport
+	void layoutItems();
+	void clearItems();
+	// Takes every shown widget out and keeps it as a spare
+	void recycleItems();
+	void resetItems(size_t count, ItemBinder bind);
+};
+
+}
@@ -1,13 +1,24 @@
 #pragma once
 
+#include <atomic>
 #include <list>
+#include <vector>
 #include <unordered_map>
 #include <memory>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include <functional>
 #include <utility>
+#include <string>
+#include <type_traits>
+#include <initializer_list>
 #include <pugixml.hpp>
+#include <qdf.h>
+#include <string_view>
+#include <stdexcept>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
 
 namespace ng::ui
 {
@@ -20,10 +31,34 @@ struct Point
 struct Size
 {
 	int w, h;
+
+	bool operator==(const Size &other) const
+	{
+		return w == other.w && h == other.h;
+	}
+
+	bool operator!=(const Size &other) const
+	{
+		return !(*this == other);
+	}
 };
 
 struct Box
 {
+	Box()
+		: x(0)
+		, y(0)
+		, w(0)
+		, h(0)
+	{}
+
+	Box(int x, int y, int w, int h)
+		: x(x)
+		, y(y)
+		, w(w)
+		, h(h)
+	{}
+
 	Box(Size size)
 		: x(0)
 		, y(0)
@@ -41,6 +76,36 @@ struct Box
 	int x, y, w, h;
 
 	SDL_Rect toSDLRect();
+
+	bool empty() const
+	{
+		return w <= 0 || h <= 0;
+	}
+
+	bool contains(Point point) const
+	{
+		return point.x >= x && point.x < x + w && point.y >= y && point.y < y + h;
+	}
+
+	bool intersects(const Box &other) const
+	{
+		return x < other.x + other.w && other.x < x + w
+			&& y < other.y + other.h && other.y < y + h;
+	}
+
+	// Smallest box containing both
+	Box united(const Box &other) const;
+	Box intersected(const Box &other) const;
+
+	bool operator==(const Box &other) const
+	{
+		return x == other.x && y == other.y && w == other.w && h == other.h;
+	}
+
+	bool operator!=(const Box &other) const
+	{
+		return !(*this == other);
+	}
 };
 
 struct Color
@@ -60,10 +125,125 @@ struct Color
 	{}
 
 	unsigned char r, g, b, a;
+
+	bool operator==(const Color &other) const
+	{
+		return r == other.r && g == other.g && b == other.b && a == other.a;
+	}
+
+	bool operator!=(const Color &other) const
+	{
+		return !(*this == other);
+	}
 };
 
 class Window;
 class Widget;
+class WidgetArena;
+class Prototype;
+class FileWatcher;
+struct Pixmap;
+class Font;
+struct TextRun;
+class GlyphAtlas;
+struct MouseEvent;
+struct KeyEvent;
+
+template <typename T>
+class SpatialGrid;
+
+using WidgetConstructor = Widget *(*)(WidgetArena *arena);
+
+// Allocated from arena if there is one, otherwise on the heap
+template <typename T>
+Widget *constructWidget(WidgetArena *arena);
+
+// FNV-1a, constexpr so registered names are hashed at compile time
+constexpr uint32_t hashName(std::string_view name)
+{
+	uint32_t hash = 2166136261u;
+	for (char c : name)
+	{
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * Every widget type by tag name. Widget, Image, Label, VirtualList and
+ * GraphCanvas are always there, other types add themselves with
+ * NGUI_REGISTER_WIDGET. Lookups go to an open addressing table kept at most
+ * half full, so a tag almost always resolves in a single probe.
+ */
+class WidgetRegistry
+{
+public:
+	static WidgetRegistry &shared();
+
+	// Replaces whatever was registered under name before. Returns true for NGUI_REGISTER_WIDGET.
+	bool add(std::string_view name, uint32_t hash, WidgetConstructor construct);
+
+	bool add(std::string_view name, WidgetConstructor construct)
+	{
+		return add(name, hashName(name), construct);
+	}
+
+	struct Entry
+	{
+		uint32_t hash = 0;
+		// Interned, so it stays valid for good. Empty for a free slot.
+		std::string_view name;
+		WidgetConstructor construct = nullptr;
+	};
+
+	// Null if nothing is registered under name. Only valid until the next add().
+	const Entry *lookup(std::string_view name, uint32_t hash) const;
+
+	const Entry *lookup(std::string_view name) const
+	{
+		return lookup(name, hashName(name));
+	}
+
+	// Null if nothing is registered under name
+	WidgetConstructor find(std::string_view name) const
+	{
+		const Entry *entry = lookup(name);
+		return entry ? entry->construct : nullptr;
+	}
+
+private:
+	WidgetRegistry();
+
+	using Slot = Entry;
+
+	// Size is always a power of two
+	std::vector<Slot> slots;
+	size_t count = 0;
+	std::list<std::string> names;
+
+	Slot &slot(std::string_view name, uint32_t hash);
+};
+
+#define NGUI_CONCAT_(a, b) a##b
+#define NGUI_CONCAT(a, b) NGUI_CONCAT_(a, b)
+
+/**
+ * Registers a widget type under a tag name at static initialization, e.g.
+ * NGUI_REGISTER_WIDGET(NodeCard, "NodeCard"); at namespace scope in the type's
+ * source file.
+ */
+#define NGUI_REGISTER_WIDGET(Type, name) \
+	static const bool NGUI_CONCAT(nguiRegistered, __LINE__) = \
+		::ng::ui::WidgetRegistry::shared().add(name, ::ng::ui::hashName(name), &::ng::ui::constructWidget<Type>)
+
+enum class RenderBackend
+{
+	// SDL_Renderer on a real window
+	Accelerated,
+	// In-memory framebuffer with no window at all, see software.h
+	Software,
+};
 
 class Application
 {
@@ -72,35 +252,138 @@ public:
 	~Application();
 	void addWindow(Window *win);
 
-	[[noreturn]]
+	/**
+	 * Runs until quit() is called or the last window is closed. The loop sleeps
+	 * in SDL_WaitEvent, so an idle application costs nothing.
+	 */
 	void mainLoop();
 
+	/**
+	 * Handles everything that is pending and redraws invalidated windows. Blocks
+	 * for at most timeout ms waiting for the first event (-1 waits forever), so
+	 * hosts that own their own loop can call this instead of mainLoop().
+	 * Returns false once the application has been asked to quit.
+	 */
+	bool processEvents(int timeout = 0);
+
+	// Safe to call from any thread. Sticks until mainLoop() is started again.
+	void quit();
+
+	// Wakes up a blocked mainLoop. Safe to call from any thread.
+	void wake();
+
+	/**
+	 * Calls callback every interval ms on the UI thread for as long as it
+	 * returns true.
+	 */
+	void addTimer(Uint32 interval, std::function<bool ()> callback);
+
+	// Same as NGUI_REGISTER_WIDGET, for types registered at runtime
 	template <typename T>
-	void registerWidget(std::string name)
+	void registerWidget(std::string_view name)
 	{
-		constructors[std::move(name)] = []() -> Widget *
-		{
-			return dynamic_cast<Widget *>(new T);
-		};
+		WidgetRegistry::shared().add(name, &constructWidget<T>);
 	}
 
+	// Allocated from arena if there is one, otherwise on the heap
 	template <typename T>
-	T *widgetByName(const std::string &name)
+	T *widgetByName(std::string_view name, WidgetArena *arena = nullptr)
 	{
-		if (constructors.find(name) == constructors.end())
+		const WidgetRegistry::Entry *entry = WidgetRegistry::shared().lookup(name);
+		if (!entry)
 		{
-			throw std::invalid_argument("Cannot find widget with name '" + name + "'");
+			throw std::invalid_argument("Cannot find widget with name '" + std::string(name) + "'");
 		}
-		return dynamic_cast<T *>(constructors[name]());
+
+		Widget *widget = entry->construct(arena);
+		setTag(widget, entry->name);
+
+		if constexpr (std::is_same_v<T, Widget>)
+			return widget;
+		else
+			return dynamic_cast<T *>(widget);
 	}
 
+	// The whole tree lives in one arena owned by the returned root, see Widget::destroy
 	Widget *fromFile(const char *path);
-	Widget *widgetFromMarkup(pugi::xml_node doc);
+	Widget *widgetFromMarkup(pugi::xml_node doc, WidgetArena *arena = nullptr);
 	void populateFromMarkup(Widget *widget, pugi::xml_node doc);
 
+	/**
+	 * Same as fromFile(), but the tree follows the file as it's edited. Each
+	 * save is diffed against what was loaded before, matching elements by id
+	 * or else by position: only properties that changed in the markup are set
+	 * again and only added or removed elements are built or destroyed, so the
+	 * rest keep their textures, layout and listeners. Changes are only noticed
+	 * on Linux; elsewhere this is just fromFile().
+	 */
+	Widget *watchFile(const char *path);
+	// Stops following the file. Must be called before root is destroyed.
+	void unwatch(Widget *root);
+
+	// Brings widget, which was built from old, in line with doc
+	void patchFromMarkup(Widget *widget, pugi::xml_node old, pugi::xml_node doc);
+
+	/**
+	 * Same as fromFile(), but for QDF documents. Blocks without values are
+	 * widgets, anything with values is a property of the enclosing widget:
+	 *
+	 *     Widget {
+	 *         id root
+	 *         Image { src "/path/to/image.png" }
+	 *     }
+	 */
+	Widget *fromQDF(const char *path);
+	Widget *widgetFromQDF(ng::qdf::QDF &node, WidgetArena *arena = nullptr);
+	void populateFromQDF(Widget *widget, ng::qdf::QDF &node);
+
+	/**
+	 * Parses a fragment once so copies of it can be made with instantiate(),
+	 * without going back to the DOM or re-parsing any property values.
+	 * Registering the same name again replaces the old prototype.
+	 */
+	const Prototype &registerPrototype(const std::string &name, pugi::xml_node doc);
+	const Prototype &prototype(const std::string &name) const;
+	Widget *instantiate(const std::string &name, WidgetArena *arena = nullptr) const;
+
 private:
 	std::list<Window *> windows;
-	std::unordered_map<std::string, std::function<Widget *(void)>> constructors;
+	std::unordered_map<std::string, std::unique_ptr<Prototype>> prototypes;
+
+	struct Timer
+	{
+		// Never reused, unlike the address of a timer that's been removed
+		uintptr_t id;
+		SDL_TimerID sdlTimer;
+		std::function<bool ()> callback;
+	};
+
+	// Set by quit() from any thread, only mainLoop() sets it again
+	std::atomic<bool> running{true};
+	Uint32 wakeEvent;
+	std::list<Timer> timers;
+	uintptr_t nextTimerId = 1;
+
+	struct WatchedFile
+	{
+		std::string path;
+		Widget *root;
+		// What root currently matches
+		std::shared_ptr<pugi::xml_document> document;
+	};
+
+	std::list<WatchedFile> watched;
+	std::unique_ptr<FileWatcher> watcher;
+
+	void reload(const std::string &path);
+
+	void handleEvent(const SDL_Event &event);
+	Window *windowById(Uint32 id);
+	// Appends doc and everything under it to prototype, in pre-order
+	void flatten(Prototype &prototype, pugi::xml_node doc);
+	// Widget is still incomplete where widgetByName is defined
+	static void setTag(Widget *widget, std::string_view tag);
+	static Uint32 timerFired(Uint32 interval, void *param);
 };
 
 class Texture
@@ -114,16 +397,109 @@ public:
 		: texture(texture, SDL_DestroyTexture)
 	{}
 
-	operator bool()
+	explicit Texture(std::shared_ptr<Pixmap> pixmap)
+		: pixmap(std::move(pixmap))
+	{}
+
+	operator bool() const
 	{
 		// ternary operator necessary to coerce to bool
-		return static_cast<bool>(texture);
+		return static_cast<bool>(texture) || static_cast<bool>(pixmap);
+	}
+
+	Size getSize() const;
+
+	// Rough amount of memory the pixels take up
+	size_t bytes() const
+	{
+		Size size = getSize();
+		return static_cast<size_t>(size.w) * size.h * 4;
+	}
+
+	// Whether anything other than this handle keeps the pixels alive
+	bool shared() const
+	{
+		return texture ? texture.use_count() > 1 : pixmap.use_count() > 1;
 	}
 
 private:
 	friend class Renderer;
+	friend class SoftwareRenderer;
 
 	std::shared_ptr<SDL_Texture> texture;
+	// Used instead of texture by the software renderer
+	std::shared_ptr<Pixmap> pixmap;
+};
+
+/**
+ * Textures by key (usually a path) so the same image is only decoded and
+ * uploaded once. Entries nothing else references anymore are evicted, least
+ * recently used first, once the cache goes over budget.
+ */
+class TextureCache
+{
+public:
+	Texture find(const std::string &key);
+	void insert(const std::string &key, const Texture &texture);
+	void clear();
+
+	void setBudget(size_t bytes)
+	{
+		budget = bytes;
+		trim();
+	}
+
+	size_t usedBytes() const
+	{
+		return used;
+	}
+
+	unsigned long hits() const
+	{
+		return hitCount;
+	}
+
+	unsigned long misses() const
+	{
+		return missCount;
+	}
+
+	unsigned long evictions() const
+	{
+		return evictionCount;
+	}
+
+private:
+	struct Entry
+	{
+		Texture texture;
+		size_t bytes;
+		std::list<std::string>::iterator recent;
+	};
+
+	std::unordered_map<std::string, Entry> entries;
+	// Most recently used first
+	std::list<std::string> recent;
+	size_t budget = 128 * 1024 * 1024;
+	size_t used = 0;
+
+	unsigned long hitCount = 0;
+	unsigned long missCount = 0;
+	unsigned long evictionCount = 0;
+
+	void trim();
+};
+
+// Cubic bezier from (x0, y0) to (x3, y3), pulled towards the two points between
+struct Bezier
+{
+	float x0, y0, x1, y1, x2, y2, x3, y3;
+
+	bool operator==(const Bezier &other) const
+	{
+		return x0 == other.x0 && y0 == other.y0 && x1 == other.x1 && y1 == other.y1
+			&& x2 == other.x2 && y2 == other.y2 && x3 == other.x3 && y3 == other.y3;
+	}
 };
 
 /**
@@ -136,95 +512,618 @@ public:
 	explicit Renderer(Window *win);
 	virtual ~Renderer();
 	virtual void rect(Box at, Color color);
+	virtual void fill(Box at, Color color);
+	// From a to b, width pixels across
+	virtual void line(Point a, Point b, Color color, int width = 1);
+
+	/**
+	 * Thick curve, drawn at p * scale + origin so it can be given in its own
+	 * coordinates. Tessellations are cached by control points, width and how
+	 * far scale is zoomed, so a curve that didn't change is only transformed
+	 * again as the view pans or zooms a little.
+	 */
+	virtual void curve(const Bezier &bezier, float width, Color color, float scale = 1, SDL_FPoint origin = {0, 0});
+
+	// Curves tessellated so far, as opposed to found in the cache
+	unsigned long curveTessellations() const
+	{
+		return tessellations;
+	}
+
+	// Cached, see textureCache()
 	virtual Texture loadImage(const char *file);
+	// Like loadImage(), for an image that has already been decoded under that key
+	Texture loadImage(const char *key, SDL_Surface *decoded);
+	// Uploads decoded pixels in whatever form the backend draws from
+	virtual Texture textureFromSurface(SDL_Surface *surface);
+	/**
+	 * Like textureFromSurface(), for ARGB8888 pixels whose colors have already
+	 * been multiplied by alpha. SDL textures made this way blend as
+	 * premultiplied, and the software renderer takes them as they are.
+	 */
+	virtual Texture textureFromPremultiplied(SDL_Surface *surface);
 	virtual void texture(const Texture &texture, Box at);
-	virtual void clear();
+	// Just the source part of texture, with every pixel multiplied by tint
+	virtual void texture(const Texture &texture, Box source, Box at, Color tint = Color(255, 255, 255));
+
+	/**
+	 * run as laid out by font, with its top left at at. Glyphs are rasterized
+	 * into a shared atlas the first time they're drawn, so text is only ever
+	 * textured quads and a label's glyphs usually share a single draw call.
+	 */
+	virtual void text(Font &font, const TextRun &run, Point at, Color color);
+	// Replaces everything in the current target, including its alpha
+	virtual void clear(Color color = Color(0, 0, 0));
 	virtual void present();
 
+	// Restricts drawing to clip, or lifts the restriction if clip is null
+	virtual void setClip(const Box *clip);
+
+	// Narrows the clip to box, in drawing coordinates, until the matching popClip()
+	void pushClip(Box box);
+	void popClip();
+
+	/**
+	 * Offscreen textures that can be drawn into with setTarget(). They hold
+	 * premultiplied colors and are drawn blending that way, so a layer looks
+	 * the same as drawing its contents directly. Returns an empty texture if
+	 * the backend can't render to textures.
+	 */
+	virtual Texture createTarget(Size size);
+	virtual void setTarget(const Texture &target);
+	virtual void resetTarget();
+
+	// Size of what's being drawn to, in pixels
+	virtual Size outputSize();
+
+	// Whether anything drawn inside box would survive the current clip
+	bool visible(const Box &box) const
+	{
+		return !clipping || clipBox.intersects(translated(box));
+	}
+
+	/**
+	 * Redirects drawing into layer, a texture from createTarget(), with origin
+	 * at its top left corner. The clip is lifted until endLayer() puts back
+	 * the previous target, clip and origin. Layers can be nested.
+	 */
+	void beginLayer(const Texture &layer, Point origin);
+	void endLayer();
+
+	/**
+	 * While batching (the default) rect, fill, line and texture calls are only
+	 * recorded. flush() submits them with as few SDL calls as possible, and is
+	 * called automatically by present() and before the clip or target change.
+	 */
+	void setBatching(bool enabled);
+	virtual void flush();
+
+	TextureCache &textureCache()
+	{
+		return images;
+	}
+
+	/**
+	 * For after the device has been reset, taking every texture with it.
+	 * Cached images and glyph pages are dropped, and textureGeneration()
+	 * changes so anything holding textures of its own knows to make them again.
+	 */
+	void texturesLost();
+
+	unsigned textureGeneration() const
+	{
+		return generation;
+	}
+
+protected:
+	// For backends that don't use SDL_Renderer at all
+	Renderer();
+
+	// In target coordinates, unaffected by the layer origin
+	bool clipping = false;
+	Box clipBox;
+	TextureCache images;
+	// What setTarget() last set, empty while drawing to the screen
+	Texture activeTarget;
+	// Added to everything drawn, moves a layer's origin to its top left
+	Point offset = {0, 0};
+
+	Box translated(Box box) const
+	{
+		return Box(box.x + offset.x, box.y + offset.y, box.w, box.h);
+	}
+
+	// A curve flattened into a strip of quads, left and right edge in turn
+	struct CurveStrip
+	{
+		std::vector<SDL_FPoint> points;
+		float left, top, right, bottom;
+		// Frame it was last drawn in
+		unsigned long used;
+	};
+
+	// From the cache, which keeps it until a few frames after it was last asked for
+	const CurveStrip &tessellate(const Bezier &bezier, float width, float scale);
+	// Called by present(), drops curves that haven't been drawn for a while
+	void endFrame();
+
 private:
 	friend class Window;
 
-	Window *window;
-	SDL_Renderer *renderer;
+	enum class DrawKind : unsigned char
+	{
+		Outline,
+		Fill,
+		Copy,
+		// The command's rect holds the end points, x1 y1 x2 y2
+		Line,
+		// The command's rect.x is an index into curveDraws
+		Curve,
+		// The command's rect.x is an index into regionDraws
+		Region,
+	};
+
+	// Commands sharing all of a batch's state, submitted with one SDL call
+	struct DrawBatch
+	{
+		DrawKind kind;
+		Color color;
+		std::shared_ptr<SDL_Texture> texture;
+		// Of lines, 0 for everything else
+		int width;
+		// Union of everything in the batch, so later commands know what they can't move past
+		Box bounds;
+		unsigned count;
+		unsigned first;
+	};
+
+	struct DrawCommand
+	{
+		unsigned batch;
+		SDL_Rect rect;
+	};
+
+	Window *window = nullptr;
+	SDL_Renderer *renderer = nullptr;
+
+	bool batching = true;
+	std::vector<DrawBatch> batches;
+	std::vector<DrawCommand> commands;
+	// Scratch space reused between flushes
+	std::vector<SDL_Rect> sortedRects;
+	std::vector<SDL_Vertex> vertices;
+	std::vector<int> indices;
+
+	bool drawColorSet = false;
+	Color drawColor = Color(0, 0, 0);
+
+	// What beginLayer() replaced
+	struct LayerState
+	{
+		Texture target;
+		bool clipping;
+		Box clipBox;
+		Point offset;
+	};
+
+	std::vector<LayerState> layerStack;
+	// What pushClip() replaced, as clipBox or nothing
+	std::vector<std::pair<bool, Box>> clipStack;
+
+	struct CurveKey
+	{
+		Bezier bezier;
+		float width;
+		// Scale in half octaves, rounded down
+		int zoom;
+
+		bool operator==(const CurveKey &other) const
+		{
+			return bezier == other.bezier && width == other.width && zoom == other.zoom;
+		}
+	};
+
+	struct CurveKeyHash
+	{
+		size_t operator()(const CurveKey &key) const;
+	};
+
+	struct CurveDraw
+	{
+		const CurveStrip *strip;
+		float scale;
+		SDL_FPoint origin;
+	};
+
+	std::unordered_map<CurveKey, CurveStrip, CurveKeyHash> curves;
+	unsigned long curveFrame = 0;
+	unsigned long tessellations = 0;
+	// Recorded curves, until the next flush
+	std::vector<CurveDraw> curveDraws;
+	std::vector<int> curveIndices;
+	std::vector<SDL_Point> linePoints;
+
+	struct RegionDraw
+	{
+		SDL_Rect source;
+		SDL_Rect dest;
+	};
+
+	// Recorded parts of textures, until the next flush
+	std::vector<RegionDraw> regionDraws;
+	// Made on the first text() call
+	std::unique_ptr<GlyphAtlas> glyphs;
+	unsigned generation = 0;
+
+	void record(DrawKind kind, Color color, const std::shared_ptr<SDL_Texture> &texture, Box at);
+	// bounds is what's drawn on, command what's submitted
+	void record(DrawKind kind, Color color, const std::shared_ptr<SDL_Texture> &texture, int width, Box bounds,
+		const SDL_Rect &command);
+	// Indices for count quads of four vertices each
+	void quadIndices(int count);
+	void setDrawColor(Color color);
+	void submit(const DrawBatch &batch, const SDL_Rect *rects);
 };
 
 class Window
 {
 	friend class Renderer;
+	friend class Application;
 
 public:
-	explicit Window(const char *name);
+	/**
+	 * A Software window is headless: nothing is shown on screen and the frame
+	 * can be read back from its SoftwareRenderer instead.
+	 */
+	explicit Window(const char *name, RenderBackend backend = RenderBackend::Accelerated, Size size = {720, 720});
 	~Window();
 
 	template <typename T>
-	T &centralWidget()
+	T &centralWidget();
+
+	void setCentralWidget(Widget *widget);
+
+	void update();
+
+	// Schedules a full redraw on the next pass of the main loop
+	void invalidate()
 	{
-		if (central)
-			return *dynamic_cast<T *>(central);
+		dirty = true;
+		fullDamage = true;
+	}
+
+	// Schedules a redraw of just the given part of the window
+	void damage(Box box);
 
-		T *widget = new T;
-		central = dynamic_cast<Widget *>(widget);
-		return *widget;
+	// Runs update() on the next pass without damaging anything, e.g. for layout
+	void scheduleUpdate()
+	{
+		dirty = true;
 	}
 
-	void setCentralWidget(Widget *widget)
+	bool needsUpdate() const
 	{
-		central = widget;
+		return dirty;
 	}
 
-	void update();
+	/**
+	 * Whether the window has something to draw and its display is ready for
+	 * another frame. Minimized windows never are.
+	 */
+	bool frameDue(Uint64 now) const
+	{
+		return dirty && !minimized && now >= nextFrame;
+	}
+
+	// Milliseconds until frameDue(), rounded up, or -1 if nothing is waiting to be drawn
+	int msUntilFrame(Uint64 now) const;
+
+	// Of the display the window is on, 0 for headless windows which aren't paced
+	int getRefreshRate() const
+	{
+		return refreshRate;
+	}
+
+#ifdef NGUI_PROFILER
+	// Frame time graph from the Profiler, drawn over everything else
+	void setProfilerOverlay(bool on)
+	{
+		profilerOverlay = on;
+		invalidate();
+	}
+#endif
 
 	Size getSize();
 
+	/**
+	 * Called once the user has closed the window. It's hidden and no longer
+	 * updated by then, but still has to be destroyed by whoever owns it.
+	 */
+	void onClose(std::function<void ()> handler)
+	{
+		closeHandler = std::move(handler);
+	}
+
+	Renderer &getRenderer()
+	{
+		return *renderer;
+	}
+
+	// Topmost widget at point, in window coordinates, from where widgets were last drawn
+	Widget *widgetAt(Point point) const;
+
+	// Where key events go first, the central widget if nothing has focus
+	Widget *getFocus() const
+	{
+		return focused;
+	}
+
+	void setFocus(Widget *widget);
+
+	// Memory the cached layers of this window's widgets may take up together
+	void setLayerBudget(size_t bytes);
+
+	size_t layerBytes() const
+	{
+		return layerUsed;
+	}
+
 private:
+	friend class Widget;
+
 	Renderer *renderer;
 	Widget *central = nullptr;
 	SDL_Window *window = nullptr;
+	bool dirty = true;
+	Size layoutSize = {0, 0};
+
+	// Everything is drawn into the backbuffer, so areas that weren't damaged
+	// keep what was drawn in previous frames
+	Texture backbuffer;
+	Size backbufferSize = {0, 0};
+	std::vector<Box> damaged;
+	bool fullDamage = true;
+	Color background = Color(0, 0, 0);
+
+	// Frames are paced to the window's own display rather than vsync, so
+	// windows on different monitors never wait on each other's present
+	int refreshRate = 0;
+	// In performance counter ticks
+	Uint64 frameInterval = 0;
+	Uint64 nextFrame = 0;
+	bool minimized = false;
+	std::function<void ()> closeHandler;
+
+	// Widgets with a cached layer, most recently drawn first
+	std::list<Widget *> layers;
+	size_t layerUsed = 0;
+	size_t layerBudget = 64 * 1024 * 1024;
+
+	void addLayer(Widget *widget);
+	void touchLayer(Widget *widget);
+	void removeLayer(Widget *widget);
+	// The backbuffer and layers lost their contents, and with device every other texture
+	void targetsLost(bool device);
+
+	// Every widget by where it was last drawn, for hit testing
+	std::unique_ptr<SpatialGrid<Widget *>> hitIndex;
+	Widget *hovered = nullptr;
+	// Gets every mouse event from a press until the release
+	Widget *captured = nullptr;
+	Widget *focused = nullptr;
+	Point mouse = {0, 0};
+
+	void handleMouse(const SDL_Event &event);
+	// SDL reports the mouse in window units, which HiDPI displays don't draw 1:1
+	Point toPixels(int x, int y) const;
+	void handleKey(const SDL_Event &event);
+	// Delivers event to target and then its ancestors until one handles it
+	Widget *dispatch(Widget *target, MouseEvent event);
+	Widget *dispatch(Widget *target, const KeyEvent &event);
+	void hover(Widget *widget);
+	// Records that widget is now drawn at box
+	void reindex(Widget *widget, Box box);
+	// Called as widget is destroyed
+	void forget(Widget *widget);
+#ifdef NGUI_PROFILER
+	bool profilerOverlay = false;
+#endif
+
+	void handleEvent(const SDL_Event &event);
+	void updateRefreshRate();
 };
 
+struct MouseEvent
+{
+	enum class Type
+	{
+		Press,
+		Release,
+		Move,
+		Wheel,
+		// Sent to just the widget the pointer moved onto or off, without bubbling
+		Enter,
+		Leave,
+	};
+
+	Type type;
+	// In window coordinates
+	Point position;
+	// Relative to the widget the event is being delivered to
+	Point local;
+	// SDL_BUTTON_LEFT and so on, for Press and Release
+	int button = 0;
+	int clicks = 0;
+	// Scrolled amount, for Wheel
+	int wheelX = 0;
+	int wheelY = 0;
+	Uint16 modifiers = 0;
+};
+
+struct KeyEvent
+{
+	enum class Type
+	{
+		Press,
+		Release,
+		// Composed text, which is what text fields should use rather than keys
+		Text,
+	};
+
+	Type type;
+	SDL_Keycode key = SDLK_UNKNOWN;
+	Uint16 modifiers = 0;
+	bool repeat = false;
+	std::string text;
+};
+
+/**
+ * A widget property. Values are parsed once when they're assigned, so reading
+ * one back as any type is just a field read. The string form is only rebuilt
+ * when something asks for it.
+ */
 class Property
 {
 public:
-	Property() = default;
+	// What the value was assigned as, or what its text parsed as
+	enum class Type : unsigned char
+	{
+		String,
+		Int,
+		Float,
+		Bool,
+		Color,
+	};
 
-	explicit Property(std::string value)
-		: value(std::move(value))
-	{}
+	Property();
+	explicit Property(std::string value);
+
+	// Only moved while nothing is bound to it, like when filling a Prototype
+	Property(Property &&other) noexcept;
+	Property &operator=(Property &&other) noexcept;
+	~Property();
 
 	Property &operator=(std::string other)
 	{
-		value = std::move(other);
+		assign(std::move(other));
 		changed();
 		return *this;
 	}
 
+	Property &operator=(const char *other)
+	{
+		return *this = std::string(other);
+	}
+
+	Property &operator=(std::string_view other)
+	{
+		return *this = std::string(other);
+	}
+
 	Property &operator=(int other)
 	{
-		value = std::to_string(other);
+		setNumber(Type::Int, other, static_cast<float>(other));
+		changed();
+		return *this;
+	}
+
+	Property &operator=(float other)
+	{
+		setNumber(Type::Float, saturate(other), other);
+		changed();
+		return *this;
+	}
+
+	// Any other number. Integers that don't fit an int are kept as floats.
+	template <typename T, std::enable_if_t<std::is_arithmetic_v<T>, int> = 0>
+	Property &operator=(T other)
+	{
+		if constexpr (std::is_integral_v<T>)
+		{
+			if (static_cast<double>(other) >= INT_MIN && static_cast<double>(other) <= INT_MAX)
+			{
+				setNumber(Type::Int, static_cast<int>(other), static_cast<float>(other));
+				changed();
+				return *this;
+			}
+		}
+
+		setNumber(Type::Float, saturate(static_cast<double>(other)), static_cast<float>(other));
 		changed();
 		return *this;
 	}
 
 	Property &operator=(bool other)
 	{
-		value = std::to_string(other);
+		setNumber(Type::Bool, other, other);
+		changed();
+		return *this;
+	}
+
+	Property &operator=(Color other)
+	{
+		setNumber(Type::Color, 0, 0);
+		color = other;
+		flag = other.a > 0;
 		changed();
 		return *this;
 	}
 
-	explicit operator bool()
+	Type type() const
 	{
-		return value.length() > 0 && value != "false";
+		return valueType;
 	}
 
-	explicit operator int()
+	// Whether the value can be read as a number
+	bool numeric() const
 	{
-		return std::stoi(value);
+		return valueType == Type::Int || valueType == Type::Float || valueType == Type::Bool;
 	}
 
-	explicit operator std::string()
+	int toInt() const
 	{
-		return value;
+		return integer;
+	}
+
+	float toFloat() const
+	{
+		return real;
+	}
+
+	// False for empty, "false" and zero
+	bool toBool() const
+	{
+		return flag;
+	}
+
+	Color toColor() const
+	{
+		return color;
+	}
+
+	const std::string &toString() const;
+
+	// Position of the value in options, or fallback if it's none of them
+	int index(std::initializer_list<const char *> options, int fallback = -1) const;
+
+	explicit operator bool() const
+	{
+		return flag;
+	}
+
+	explicit operator int() const
+	{
+		return integer;
+	}
+
+	explicit operator float() const
+	{
+		return real;
+	}
+
+	explicit operator std::string() const
+	{
+		return toString();
 	}
 
 	void onChange(std::function<void (std::string)> listener)
@@ -233,59 +1132,535 @@ public:
 	}
 
 private:
-	std::string value;
+	friend class Widget;
+	friend class PropertyBatch;
+
+	struct Binding;
+	struct Links;
+
+	/**
+	 * Only up to date while textStale is false. Never modified in place, so
+	 * copies made from a Prototype can share it until they're assigned to.
+	 */
+	mutable std::shared_ptr<const std::string> text;
+	mutable bool textStale = false;
+	Type valueType = Type::String;
+	bool flag = false;
+	int integer = 0;
+	float real = 0;
+	Color color = Color(0, 0, 0, 0);
+
 	std::list<std::function<void (std::string)>> listeners;
+	// Widget that gets repainted when this changes
+	Widget *owner = nullptr;
+	// Bindings setting and reading this, only allocated once there are any
+	mutable std::unique_ptr<Links> links;
+	// Waiting in a batch to be notified
+	bool queued = false;
+
+	void assign(std::string source);
+	// Takes over other's value, sharing its text
+	void share(const Property &other);
 
-	void changed()
+	// As an int, stopping at its limits rather than overflowing
+	static int saturate(double value)
 	{
-		for (const auto &f : listeners)
-		{
-			f(value);
-		}
+		if (value != value)
+			return 0;
+		if (value <= INT_MIN)
+			return INT_MIN;
+		if (value >= INT_MAX)
+			return INT_MAX;
+		return static_cast<int>(value);
 	}
+
+	void setNumber(Type type, int i, float f)
+	{
+		valueType = type;
+		integer = i;
+		real = f;
+		flag = f != 0;
+		color = Color(0, 0, 0, 0);
+		textStale = true;
+	}
+
+	void changed();
+	// Runs the listeners and repaints the owner
+	void notify();
+
+	Links &linked() const;
+	// Replaces whatever was setting this. Throws if it would depend on itself.
+	void bind(std::unique_ptr<Binding> binding);
+	void unbind();
+	// Moves bindings that read this after the one that sets it
+	void raiseDependents();
+};
+
+/**
+ * Holds back property notifications while one is alive. However many times a
+ * property is set, its bindings and listeners run once, with the final value,
+ * when changes are flushed. The main loop does that every frame before layout,
+ * as does Window::update(), or flush() can be called directly.
+ *
+ * Outside of a batch, setting a property notifies straight away.
+ */
+class PropertyBatch
+{
+public:
+	PropertyBatch();
+	~PropertyBatch();
+	PropertyBatch(const PropertyBatch &) = delete;
+	PropertyBatch &operator=(const PropertyBatch &) = delete;
+
+	// Runs bindings in dependency order, then listeners, until nothing changes
+	static void flush();
 };
 
 class Widget
 {
 public:
-	virtual ~Widget() = default;
-	
+	Widget() = default;
+	Widget(const Widget &) = delete;
+	Widget &operator=(const Widget &) = delete;
+	virtual ~Widget();
+
 	virtual void render(Box boundingBox, Renderer &renderer);
 
+	// Allocated next to this widget, from the same arena
 	template <typename T>
-	T &newChild()
-	{
-		T *child = new T;
-		children.push_back(std::shared_ptr<Widget>(dynamic_cast<Widget *>(child)));
-		return *child;
-	}
+	T &newChild();
 
+	// Takes ownership of child
 	template <typename T>
 	void addChild(T *child)
 	{
-		children.push_back(std::shared_ptr<Widget>(dynamic_cast<Widget *>(child)));
+		adopt(child);
 	}
 
-	void set(const std::string &key, std::string val)
+	/**
+	 * Takes child out without destroying it. The caller owns it from then on,
+	 * and has to add it somewhere again or pass it to destroy().
+	 */
+	void removeChild(Widget *child);
+
+	/**
+	 * Frees a widget and everything under it, taking it out of its parent first.
+	 * This is how widgets should be deleted: a widget that roots an arena takes the whole arena with it in one
+	 * go, and one inside an arena is only destructed, with its memory reclaimed
+	 * when the arena goes.
+	 */
+	static void destroy(Widget *widget);
+
+	// val can be a string, which is parsed once here, a number, bool or Color
+	template <typename T>
+	void set(const std::string &key, T &&val)
 	{
-		properties[key] = std::move(val);
+		Property &prop = property(key);
+		prop = std::forward<T>(val);
+		propertyChanged(key, prop);
 	}
 
 	void onChange(const std::string &key, std::function<void (std::string)> f)
 	{
-		properties[key].onChange(std::move(f));
+		property(key).onChange(std::move(f));
+	}
+
+	using BindingSource = std::pair<Widget *, std::string>;
+
+	/**
+	 * Keeps key set to compute(values), where values are the sources' properties
+	 * in order, and re-evaluates it whenever one of them changes. Chains of
+	 * bindings run in dependency order, each at most once per flush. Throws
+	 * std::invalid_argument if key would end up depending on itself.
+	 */
+	template <typename F>
+	void bind(const std::string &key, std::vector<BindingSource> sources, F compute)
+	{
+		bindTo(key, std::move(sources), [this, key, compute = std::move(compute)](const std::vector<const Property *> &values)
+		{
+			set(key, compute(values));
+		});
+	}
+
+	// Keeps key equal to source's sourceKey
+	void bind(const std::string &key, Widget *source, const std::string &sourceKey);
+
+	void unbind(const std::string &key);
+
+	/**
+	 * Marks the area this widget was last drawn in as needing a repaint. Called
+	 * automatically when one of its properties changes.
+	 */
+	void invalidate();
+
+	Widget *getParent()
+	{
+		return parent;
+	}
+
+	Window *getWindow()
+	{
+		return window;
+	}
+
+	WidgetArena *getArena()
+	{
+		return arena;
+	}
+
+	// Name of the markup element this was created from, empty if made in code
+	std::string_view getTag() const
+	{
+		return tag;
+	}
+
+	enum class Direction
+	{
+		Column,
+		Row,
+	};
+
+	enum class Align
+	{
+		Stretch,
+		Start,
+		Center,
+		End,
+	};
+
+	/**
+	 * Positions the widget at box, relative to its parent, and lays out its
+	 * children. Nothing below this is visited if box only moved and no layout
+	 * property inside changed since the last time.
+	 */
+	void arrange(Box box);
+
+	// Size this would like within available, cached until its layout is invalidated
+	Size measure(Size available);
+
+	/**
+	 * Marks this and its ancestors as needing layout. Called automatically when
+	 * a layout property changes or children are added.
+	 */
+	void invalidateLayout();
+
+	// Where the last layout put this, relative to its parent
+	Box getLayoutBox() const
+	{
+		return layoutBox;
+	}
+
+	/**
+	 * Called with mouse events that hit this widget, or one of its children
+	 * that didn't handle them. Return true to stop them going further up.
+	 */
+	void onMouse(std::function<bool (const MouseEvent &)> handler)
+	{
+		mouseHandler = std::move(handler);
 	}
 
+	// Like onMouse(), for keys while this or one of its children has focus
+	void onKey(std::function<bool (const KeyEvent &)> handler)
+	{
+		keyHandler = std::move(handler);
+	}
+
+	// Focuses this widget in its window
+	void focus();
+	bool hasFocus() const;
+
+	// Whether this is drawn on top of other, given they overlap
+	bool isAbove(const Widget *other) const;
+
+	/**
+	 * Whether the subtree is currently drawn from a cached texture. Layers are
+	 * asked for with the "layer" property, or made automatically for large
+	 * subtrees that keep being repainted without changing. They're rendered
+	 * again when anything inside is invalidated.
+	 */
+	bool hasLayer() const
+	{
+		return static_cast<bool>(layer);
+	}
+
+protected:
+	// Properties read by the default layout, parsed when they're set
+	struct LayoutParams
+	{
+		// Fixed size, or -1 to size from content and grow
+		int width = -1;
+		int height = -1;
+		int padding = 0;
+		int spacing = 0;
+		// Share of the leftover space along the parent's direction
+		int grow = 1;
+		Direction direction = Direction::Column;
+		Align align = Align::Stretch;
+	};
+
+	LayoutParams layout;
+
+	/**
+	 * The default lays children out like a flexbox: stacked along direction,
+	 * with fixed sizes honored and the rest of the space shared out by grow.
+	 */
+	virtual Size measureContent(Size available);
+	virtual void arrangeContent(Size size);
+
+	// Called after set() has assigned a property
+	virtual void propertyChanged(const std::string &key, Property &prop);
+
+	// The defaults hand events to the onMouse() and onKey() handlers
+	virtual bool mouseEvent(const MouseEvent &event);
+	virtual bool keyEvent(const KeyEvent &event);
+
 private:
-	std::list<std::shared_ptr<Widget>> children;
+	friend class Window;
+	friend class WidgetArena;
+	friend class Prototype;
+	friend class Application;
+
+	std::vector<Widget *> children;
 	std::unordered_map<std::string, Property> properties;
+	// Interned by WidgetRegistry
+	std::string_view tag;
+
+	WidgetArena *arena = nullptr;
+	// Slot in arena's widget list
+	size_t arenaIndex = 0;
+
+	Widget *parent = nullptr;
+	Window *window = nullptr;
+	// Where this was drawn last frame, in window coordinates
+	Box lastBox;
+	bool dirty = true;
+
+	Box layoutBox;
+	// Needs arranging. Stays set on widgets that are never arranged, like hidden ones.
+	bool layoutDirty = true;
+	// Last measure() result and what it was measured against, unless measureDirty
+	Size measured = {0, 0};
+	Size measuredFor = {-1, -1};
+	bool measureDirty = false;
+
+	// Set by the "clip" property, cuts children off at this widget's box
+	bool clip = false;
+
+	// Set by the "layer" property
+	bool layerWanted = false;
+	// Promoted automatically, and dropped again as soon as it changes
+	bool layerAuto = false;
+	bool layerDirty = true;
+	Texture layer;
+	// Where the layer was rendered, in window coordinates
+	Box layerBox;
+	std::list<Widget *>::iterator layerEntry;
+	// Times painted since anything inside last changed
+	unsigned stablePaints = 0;
+
+	std::function<bool (const MouseEvent &)> mouseHandler;
+	std::function<bool (const KeyEvent &)> keyHandler;
+	// Position in the parent's children, which is also paint order
+	unsigned childIndex = 0;
+	// Whether the window's hit index has this at lastBox
+	bool indexed = false;
+
+	void adopt(Widget *child);
+	void attach(Window *win);
+	// Takes a removed subtree off its window
+	void detach();
+	void bindTo(const std::string &key, std::vector<BindingSource> sources,
+		std::function<void (const std::vector<const Property *> &)> update);
+	// Like set(), with the value shared rather than copied
+	void share(const std::string &key, const Property &value);
+	// Records where the widget is being drawn and renders it if it isn't clipped away
+	void paint(Box boundingBox, Renderer &renderer);
+	// Draws from the layer, rendering it first if needed. False if there can't be one.
+	bool paintLayer(Box boundingBox, Renderer &renderer);
+	bool shouldPromote();
+	void dropLayer();
+	// Tells this and its ancestors that what they draw has changed
+	void contentChanged();
 
 protected:
+	/**
+	 * The property itself, created if it doesn't exist yet. References stay valid
+	 * for the widget's lifetime, so hot paths can look it up once and keep it.
+	 */
+	Property &property(const std::string &key)
+	{
+		Property &prop = properties[key];
+		prop.owner = this;
+		return prop;
+	}
+
+	// Strings come back by reference, everything else by value
 	template <typename T>
-	T get(const std::string &key)
+	std::conditional_t<std::is_same_v<T, std::string>, const std::string &, T> get(const std::string &key) const
 	{
-		return static_cast<T>(properties[key]);
+		static const Property missing;
+
+		auto it = properties.find(key);
+		const Property &prop = it == properties.end() ? missing : it->second;
+
+		if constexpr (std::is_same_v<T, std::string>)
+			return prop.toString();
+		else if constexpr (std::is_same_v<T, Color>)
+			return prop.toColor();
+		else
+			return static_cast<T>(prop);
 	}
 };
 
+/**
+ * Bump allocator for the widgets of one tree. Widgets are laid out in memory
+ * in the order they're created, which for markup is the order they're
+ * traversed in, and the whole tree is torn down in one go with no per-widget
+ * frees. A widget destroyed on its own gives its memory and slot back for the
+ * next one of about the same size, so a tree that keeps replacing parts of
+ * itself doesn't keep growing.
+ */
+class WidgetArena
+{
+public:
+	WidgetArena() = default;
+	WidgetArena(const WidgetArena &) = delete;
+	WidgetArena &operator=(const WidgetArena &) = delete;
+	~WidgetArena();
+
+	template <typename T>
+	T *create()
+	{
+		void *memory = allocate(sizeof(T), alignof(T));
+		T *widget = new (memory) T;
+
+		Widget *base = widget;
+		base->arena = this;
+		base->arenaIndex = track(base, memory, sizeof(T), alignof(T));
+		return widget;
+	}
+
+	// A widget in a new arena that it owns
+	template <typename T>
+	static T *createRoot()
+	{
+		auto *arena = new WidgetArena;
+		return arena->create<T>();
+	}
+
+	// The first widget created, which owns the arena
+	Widget *root() const
+	{
+		return widgets.empty() ? nullptr : widgets.front().widget;
+	}
+
+	// Widgets alive in the arena
+	size_t size() const
+	{
+		return widgets.size() - freeSlots.size();
+	}
+
+private:
+	friend class Widget;
+
+	// Memory is handed out in multiples of this, so what one widget gives back fits others
+	static constexpr size_t grain = alignof(std::max_align_t);
+
+	struct Block
+	{
+		std::unique_ptr<char[]> memory;
+		size_t size;
+	};
+
+	struct Slot
+	{
+		// Null once destroyed on its own, until the slot is reused
+		Widget *widget;
+		void *memory;
+		// Rounded up to grains, 0 if it's aligned too strictly to reuse
+		size_t bytes;
+		// Order of creation, which slots stop following once they're reused
+		size_t serial;
+	};
+
+	std::vector<Block> blocks;
+	size_t used = 0;
+	std::vector<Slot> widgets;
+	// Empty slots in widgets
+	std::vector<size_t> freeSlots;
+	// Memory given back by release(), by size in grains
+	std::vector<std::vector<void *>> freeMemory;
+	size_t created = 0;
+	bool reused = false;
+	bool tearingDown = false;
+
+	void *allocate(size_t size, size_t align);
+	// Puts widget in a slot, returning its index
+	size_t track(Widget *widget, void *memory, size_t size, size_t align);
+	// Destructs a single widget early
+	void release(Widget *widget);
+};
+
+/**
+ * A widget tree flattened into pre-order, with every property value parsed
+ * up front. Instances share the prototype's values and only get their own
+ * copy of one when it's set again, so making one costs little more than
+ * allocating the widgets.
+ */
+class Prototype
+{
+public:
+	// Built in arena, or in a new arena owned by the returned root
+	Widget *instantiate(WidgetArena *arena = nullptr) const;
+
+	// Number of widgets in each instance
+	size_t size() const
+	{
+		return nodes.size();
+	}
+
+private:
+	friend class Application;
+
+	struct Node
+	{
+		WidgetConstructor construct;
+		std::string_view tag;
+		// One past the last node in this one's subtree
+		size_t end;
+		size_t firstProperty;
+		size_t propertyCount;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<std::pair<std::string, Property>> properties;
+};
+
+template <typename T>
+Widget *constructWidget(WidgetArena *arena)
+{
+	if (arena)
+		return arena->create<T>();
+	return new T;
+}
+
+template <typename T>
+T &Window::centralWidget()
+{
+	if (central)
+		return *dynamic_cast<T *>(central);
+
+	T *widget = WidgetArena::createRoot<T>();
+	setCentralWidget(widget);
+	return *widget;
+}
+
+template <typename T>
+T &Widget::newChild()
+{
+	T *child = arena ? arena->create<T>() : new T;
+	adopt(child);
+	return *child;
+}
+
 } // ng::ui
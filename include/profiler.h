@@ -0,0 +1,157 @@
+#pragma once
+
+/**
+ * Frame profiler, only built in when NGUI_PROFILER is defined (the CMake
+ * option of the same name). Without it the macros below expand to nothing and
+ * none of this exists, so instrumented code costs nothing in normal builds.
+ *
+ *     NGUI_PROFILE_SCOPE("layout");
+ *     NGUI_PROFILE_COUNT(DrawCalls, 1);
+ *
+ * Scope names are kept by reference and have to outlive the profiler, so use
+ * literals or interned strings like Widget::getTag().
+ */
+
+#ifdef NGUI_PROFILER
+
+#include <ngui.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace ng::ui
+{
+
+class Profiler
+{
+public:
+	enum Counter
+	{
+		DrawCalls,
+		TextureBinds,
+		TextureUploads,
+		Tessellations,
+		CounterCount,
+	};
+
+	struct Frame
+	{
+		uint64_t start;
+		uint64_t end;
+		unsigned long counters[CounterCount];
+
+		double milliseconds() const
+		{
+			return (end - start) / 1e6;
+		}
+	};
+
+	static Profiler &shared();
+
+	// Nanoseconds on a monotonic clock
+	static uint64_t now()
+	{
+		using namespace std::chrono;
+		return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Recording can be paused at runtime, it's on by default
+	void setEnabled(bool on)
+	{
+		enabled.store(on, std::memory_order_relaxed);
+	}
+
+	bool isEnabled() const
+	{
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	// Safe to call from any thread
+	void record(std::string_view name, uint64_t start, uint64_t end);
+
+	// Safe to call from any thread, n goes to whichever frame closes next
+	void count(Counter counter, unsigned long n)
+	{
+		counters[counter].fetch_add(n, std::memory_order_relaxed);
+	}
+
+	// Closes the frame that started at start, see Window::update
+	void frame(uint64_t start, uint64_t end);
+
+	// Most recent last
+	const std::deque<Frame> &frames() const
+	{
+		return history;
+	}
+
+	// Everything recorded so far as Chrome trace events, for chrome://tracing or Perfetto
+	bool writeTrace(const char *path);
+	void clear();
+
+	// Frame times of the last few frames as bars, in the top right corner of area
+	void drawOverlay(Renderer &renderer, Box area) const;
+
+private:
+	Profiler() = default;
+
+	struct Event
+	{
+		std::string_view name;
+		uint64_t start;
+		uint64_t end;
+	};
+
+	struct Thread
+	{
+		unsigned id;
+		std::mutex mutex;
+		std::vector<Event> events;
+	};
+
+	// Read by record() on whatever thread it's called from
+	std::atomic<bool> enabled{true};
+	std::atomic<unsigned long> counters[CounterCount] = {};
+	std::deque<Frame> history;
+
+	std::mutex threadsMutex;
+	std::deque<Thread> threads;
+
+	Thread &thread();
+};
+
+class ProfileScope
+{
+public:
+	explicit ProfileScope(std::string_view name)
+		: name(name)
+		, start(Profiler::now())
+	{}
+
+	~ProfileScope()
+	{
+		Profiler::shared().record(name, start, Profiler::now());
+	}
+
+	ProfileScope(const ProfileScope &) = delete;
+	ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+	std::string_view name;
+	uint64_t start;
+};
+
+}
+
+#define NGUI_PROFILE_SCOPE(name) ::ng::ui::ProfileScope NGUI_CONCAT(nguiProfileScope, __LINE__)(name)
+#define NGUI_PROFILE_COUNT(counter, n) ::ng::ui::Profiler::shared().count(::ng::ui::Profiler::counter, n)
+
+#else
+
+#define NGUI_PROFILE_SCOPE(name) ((void)0)
+#define NGUI_PROFILE_COUNT(counter, n) ((void)0)
+
+#endif
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <ngui.h>
+#include <cstdint>
+
+namespace ng::ui
+{
+
+/**
+ * 32 bit pixels packed as ARGB8888 with premultiplied alpha, rows tightly
+ * packed.
+ */
+struct Pixmap
+{
+	Pixmap(int w, int h)
+		: w(w)
+		, h(h)
+		, pixels(static_cast<size_t>(w) * h, 0)
+	{}
+
+	uint32_t *row(int y)
+	{
+		return pixels.data() + static_cast<size_t>(y) * w;
+	}
+
+	const uint32_t *row(int y) const
+	{
+		return pixels.data() + static_cast<size_t>(y) * w;
+	}
+
+	int w, h;
+	std::vector<uint32_t> pixels;
+	// Lets blits skip blending entirely
+	bool opaque = false;
+};
+
+/**
+ * Rasterizes everything into memory without SDL_Renderer, a window or a GPU.
+ * Used for headless windows, so the render path can be profiled and tested on
+ * build machines, and for offscreen thumbnails.
+ */
+class SoftwareRenderer : public Renderer
+{
+public:
+	explicit SoftwareRenderer(Size size);
+
+	void rect(Box at, Color color) override;
+	void fill(Box at, Color color) override;
+	void line(Point a, Point b, Color color, int width = 1) override;
+	void curve(const Bezier &bezier, float width, Color color, float scale = 1, SDL_FPoint origin = {0, 0}) override;
+	Texture textureFromSurface(SDL_Surface *surface) override;
+	Texture textureFromPremultiplied(SDL_Surface *surface) override;
+	void texture(const Texture &texture, Box at) override;
+	void texture(const Texture &texture, Box source, Box at, Color tint = Color(255, 255, 255)) override;
+	void clear(Color color = Color(0, 0, 0)) override;
+	void present() override;
+	void flush() override;
+
+	void setClip(const Box *clip) override;
+
+	Texture createTarget(Size size) override;
+	void setTarget(const Texture &target) override;
+	void resetTarget() override;
+
+	Size outputSize() override;
+
+	void resize(Size size);
+
+	// The framebuffer that present() shows, i.e. the finished frame
+	const Pixmap &frame() const
+	{
+		return screen;
+	}
+
+	unsigned long frameCount() const
+	{
+		return frames;
+	}
+
+	bool savePNG(const char *path) const;
+
+private:
+	Pixmap screen;
+	// Whatever is currently being drawn to, either screen or a target texture
+	Pixmap *target;
+	std::shared_ptr<Pixmap> targetTexture;
+	unsigned long frames = 0;
+	// Source column for every destination column of a scaled blit
+	std::vector<int> columns;
+	std::vector<uint32_t> scanline;
+
+	// Part of box that survives both the clip and the bounds of the target
+	Box visibleArea(Box box) const;
+};
+
+}
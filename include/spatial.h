@@ -0,0 +1,218 @@
+#pragma once
+
+#include <ngui.h>
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace ng::ui
+{
+
+/**
+ * Uniform grid of boxes for finding what's at a point or in an area without
+ * looking at everything. Every item is listed in each cell its box touches,
+ * and moving one only touches the cells it enters or leaves, so it can be
+ * kept up to date as things move instead of being rebuilt.
+ */
+template <typename T>
+class SpatialGrid
+{
+public:
+	explicit SpatialGrid(int cellSize = 64)
+		: cellSize(cellSize)
+	{}
+
+	void insert(const T &item, Box box)
+	{
+		if (box.empty())
+			return;
+
+		forCells(box, [&](int64_t key)
+		{
+			cells[key].push_back(Entry{item, box});
+		});
+		count++;
+	}
+
+	// box has to be what the item was inserted or last moved with
+	void remove(const T &item, Box box)
+	{
+		if (box.empty())
+			return;
+
+		forCells(box, [&](int64_t key)
+		{
+			erase(key, item);
+		});
+		count--;
+	}
+
+	void move(const T &item, Box from, Box to)
+	{
+		if (from.empty() || to.empty())
+		{
+			remove(item, from);
+			insert(item, to);
+			return;
+		}
+
+		Range before = range(from);
+		Range after = range(to);
+
+		forCells(from, [&](int64_t key)
+		{
+			if (!after.contains(key))
+				erase(key, item);
+		});
+
+		forCells(to, [&](int64_t key)
+		{
+			auto &cell = cells[key];
+			if (before.contains(key))
+			{
+				for (auto &entry : cell)
+				{
+					if (entry.item == item)
+						entry.box = to;
+				}
+			}
+			else
+			{
+				cell.push_back(Entry{item, to});
+			}
+		});
+	}
+
+	// Calls f(item, box) for everything whose box contains point
+	template <typename F>
+	void query(Point point, F &&f) const
+	{
+		auto it = cells.find(key(cellOf(point.x), cellOf(point.y)));
+		if (it == cells.end())
+			return;
+
+		for (const auto &entry : it->second)
+		{
+			const Box &box = entry.box;
+			if (point.x >= box.x && point.x < box.x + box.w && point.y >= box.y && point.y < box.y + box.h)
+				f(entry.item, box);
+		}
+	}
+
+	// Calls f(item, box) once for everything whose box intersects area
+	template <typename F>
+	void query(Box area, F &&f) const
+	{
+		if (area.empty())
+			return;
+
+		Range cellRange = range(area);
+		for (int cy = cellRange.top; cy <= cellRange.bottom; cy++)
+		{
+			for (int cx = cellRange.left; cx <= cellRange.right; cx++)
+			{
+				auto it = cells.find(key(cx, cy));
+				if (it == cells.end())
+					continue;
+
+				for (const auto &entry : it->second)
+				{
+					const Box &box = entry.box;
+					if (!box.intersects(area))
+						continue;
+
+					// Only reported from the first cell the overlap falls in
+					int x = std::max(box.x, area.x);
+					int y = std::max(box.y, area.y);
+					if (cellOf(x) == cx && cellOf(y) == cy)
+						f(entry.item, box);
+				}
+			}
+		}
+	}
+
+	void clear()
+	{
+		cells.clear();
+		count = 0;
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+private:
+	struct Entry
+	{
+		T item;
+		Box box;
+	};
+
+	struct Range
+	{
+		int left, top, right, bottom;
+
+		bool contains(int64_t key) const
+		{
+			int cx = static_cast<int32_t>(key >> 32);
+			int cy = static_cast<int32_t>(key & 0xffffffff);
+			return cx >= left && cx <= right && cy >= top && cy <= bottom;
+		}
+	};
+
+	int cellSize;
+	std::unordered_map<int64_t, std::vector<Entry>> cells;
+	size_t count = 0;
+
+	int cellOf(int coordinate) const
+	{
+		// Rounds towards negative infinity, so cells don't double up around 0
+		return coordinate >= 0 ? coordinate / cellSize : -((-coordinate - 1) / cellSize) - 1;
+	}
+
+	static int64_t key(int cx, int cy)
+	{
+		return static_cast<int64_t>((static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32) | static_cast<uint32_t>(cy));
+	}
+
+	Range range(Box box) const
+	{
+		return Range{cellOf(box.x), cellOf(box.y), cellOf(box.x + box.w - 1), cellOf(box.y + box.h - 1)};
+	}
+
+	template <typename F>
+	void forCells(Box box, F &&f) const
+	{
+		Range cellRange = range(box);
+		for (int cy = cellRange.top; cy <= cellRange.bottom; cy++)
+		{
+			for (int cx = cellRange.left; cx <= cellRange.right; cx++)
+				f(key(cx, cy));
+		}
+	}
+
+	void erase(int64_t cellKey, const T &item)
+	{
+		auto it = cells.find(cellKey);
+		if (it == cells.end())
+			return;
+
+		auto &cell = it->second;
+		for (size_t i = 0; i < cell.size(); i++)
+		{
+			if (cell[i].item == item)
+			{
+				cell[i] = cell.back();
+				cell.pop_back();
+				break;
+			}
+		}
+
+		if (cell.empty())
+			cells.erase(it);
+	}
+};
+
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <ngui.h>
+#include <cstdint>
+
+typedef struct _TTF_Font TTF_Font;
+
+namespace ng::ui
+{
+
+/**
+ * Glyphs placed by Font::layout(), relative to the top left of the text.
+ * Lines are split at '\n'.
+ */
+struct TextRun
+{
+	struct Glyph
+	{
+		uint32_t codepoint;
+		// Pen position, with y the top of the line
+		int x, y;
+	};
+
+	std::vector<Glyph> glyphs;
+	Size size = {0, 0};
+};
+
+/**
+ * A TrueType font at one pixel size, opened with SDL_ttf. Fonts are shared by
+ * everything using the same file and size, and keep the runs they've laid out
+ * so the same string is only measured and kerned once.
+ */
+class Font
+{
+public:
+	Font(const Font &) = delete;
+	Font &operator=(const Font &) = delete;
+	~Font();
+
+	// The one already open for path and size if there is one. Null if path can't be opened.
+	static std::shared_ptr<Font> get(const std::string &path, int size);
+
+	// Cached by text until runBudget other strings have been laid out since
+	std::shared_ptr<const TextRun> layout(const std::string &text);
+
+	// White glyph with alpha for codepoint, as drawn at the top of a line. The caller frees it.
+	SDL_Surface *rasterize(uint32_t codepoint);
+
+	int getSize() const
+	{
+		return size;
+	}
+
+	int lineHeight() const
+	{
+		return lineSkip;
+	}
+
+	// Never reused, unlike the address of a font that has been closed
+	uint32_t getId() const
+	{
+		return id;
+	}
+
+	unsigned long runsLaidOut() const
+	{
+		return layouts;
+	}
+
+private:
+	Font(TTF_Font *font, int size);
+
+	TTF_Font *font;
+	int size;
+	int lineSkip;
+	uint32_t id;
+
+	// Advances, which is all layout needs, by codepoint
+	std::unordered_map<uint32_t, int> advances;
+
+	struct Run
+	{
+		std::shared_ptr<const TextRun> run;
+		std::list<std::string>::iterator recent;
+	};
+
+	std::unordered_map<std::string, Run> runs;
+	// Most recently used first
+	std::list<std::string> recent;
+	size_t runBudget = 1024;
+	unsigned long layouts = 0;
+
+	int advance(uint32_t codepoint);
+};
+
+/**
+ * Every glyph drawn so far, packed into shelves on a few large textures. Pages
+ * are kept as surfaces too and uploaded again after glyphs are added, so any
+ * backend that can make a texture from a surface can draw text.
+ */
+class GlyphAtlas
+{
+public:
+	GlyphAtlas();
+	~GlyphAtlas();
+
+	struct Glyph
+	{
+		int page;
+		// Where in the page, empty for glyphs with nothing to draw
+		Box source;
+		// From the pen position at the top of the line
+		Point offset;
+	};
+
+	// Rasterizes codepoint on first use
+	const Glyph &find(Font &font, uint32_t codepoint);
+
+	// Uploads the page first if it got new glyphs since it was last asked for
+	const Texture &page(Renderer &renderer, int index);
+
+	// Starts over once there are too many pages. Only call it between runs.
+	void trim();
+
+	size_t pageCount() const
+	{
+		return pages.size();
+	}
+
+	size_t glyphCount() const
+	{
+		return glyphs.size();
+	}
+
+private:
+	struct Page
+	{
+		SDL_Surface *pixels;
+		Texture texture;
+		bool dirty;
+		// The shelf being filled, and how far along it is
+		int shelfY, shelfHeight, x;
+	};
+
+	std::unordered_map<uint64_t, Glyph> glyphs;
+	std::vector<Page> pages;
+
+	// Room for a w by h glyph, starting a shelf or page if need be
+	Glyph place(int w, int h);
+	void clear();
+};
+
+/**
+ * Text in "font" at "fontSize" pixels, colored "color". It's only laid out
+ * again when one of those or "text" changes, and measures as the size of its
+ * text.
+ */
+class Label : public Widget
+{
+public:
+	void render(Box boundingBox, Renderer &renderer) override;
+
+	// Null until it has both text and a font
+	const TextRun *getRun() const
+	{
+		return run.get();
+	}
+
+protected:
+	Size measureContent(Size available) override;
+	void propertyChanged(const std::string &key, Property &prop) override;
+
+private:
+	std::string text;
+	std::string fontPath;
+	int fontSize = 14;
+	Color color = Color(255, 255, 255);
+
+	std::shared_ptr<Font> font;
+	std::shared_ptr<const TextRun> run;
+
+	void relayout();
+};
+
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace ng::ui
+{
+
+/**
+ * Notices when files are written, for reloading markup while the application
+ * runs. Directories are watched rather than the files themselves, so editors
+ * that save by writing a new file and renaming it over the old one still get
+ * noticed. Only implemented with inotify, elsewhere nothing is ever reported.
+ */
+class FileWatcher
+{
+public:
+	FileWatcher();
+	~FileWatcher();
+
+	FileWatcher(const FileWatcher &) = delete;
+	FileWatcher &operator=(const FileWatcher &) = delete;
+
+	/**
+	 * Calls changed on the UI thread, through WorkerPool::post, after path has
+	 * been written. A burst of writes is reported once.
+	 */
+	void watch(const std::string &path, std::function<void ()> changed);
+	void unwatch(const std::string &path);
+
+private:
+	struct Directory
+	{
+		int descriptor;
+		// By file name within the directory
+		std::unordered_map<std::string, std::shared_ptr<std::function<void ()>>> files;
+	};
+
+	std::mutex mutex;
+	std::unordered_map<std::string, Directory> directories;
+	int inotify = -1;
+	// Written to by the destructor to get the thread out of poll()
+	int stopPipe[2] = {-1, -1};
+	std::thread thread;
+
+	void run();
+};
+
+}
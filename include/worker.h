@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ng::ui
+{
+
+/**
+ * Background threads for slow work like image decoding. Jobs can't touch
+ * widgets or renderers, so they hand their results back with post(), which
+ * queues a function to run on the UI thread the next time the main loop wakes.
+ */
+class WorkerPool
+{
+public:
+	static WorkerPool &shared();
+
+	~WorkerPool();
+
+	// Runs job on a worker thread. Threads are only started on first use.
+	void submit(std::function<void ()> job);
+
+	// Runs task on the UI thread. Safe to call from any thread.
+	void post(std::function<void ()> task);
+
+	// Runs everything posted so far. Called by the main loop.
+	void runPosted();
+
+	// Called whenever something is posted, so a sleeping main loop notices
+	void setWakeup(std::function<void ()> wakeup);
+
+private:
+	WorkerPool() = default;
+
+	std::mutex mutex;
+	std::condition_variable available;
+	std::deque<std::function<void ()>> jobs;
+	std::vector<std::thread> threads;
+	bool stopping = false;
+
+	std::mutex postedMutex;
+	std::vector<std::function<void ()>> posted;
+	std::function<void ()> wakeup;
+
+	void work();
+};
+
+}
@@ -519,6 +519,12 @@ void QDFRoot::fromFile(QDFParseError& error, const char* path)
 	f = fopen(path, "rb");
 #endif
 
+	if (!f)
+	{
+		error = QDFParseError::FILE_NOT_FOUND;
+		return;
+	}
+
 	fseek(f, 0, SEEK_END);
 	size_t len = ftell(f);
 	fseek(f, 0, 0);
@@ -529,6 +535,7 @@ void QDFRoot::fromFile(QDFParseError& error, const char* path)
 	fromString(error, buf, len);
 
 	free(buf);
+	fclose(f);
 }
 
 QDFRoot::~QDFRoot()
@@ -29,6 +29,7 @@ namespace ng::qdf{
 		UNEXPECTED_END_OF_LIST,
 
 		DATA_ALREADY_PARSED,
+		FILE_NOT_FOUND,
 	};
 	
 	
@@ -59,6 +60,8 @@ namespace ng::qdf{
 		void fromFile(QDFParseError& error, const char* path);
 	
 	private:
+		friend class QDFParser;
+
 		char* stringBuffer;
 		QDF::String* stringArray;
 		QDF* qdfArray;
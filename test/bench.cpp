@@ -0,0 +1,478 @@
+/**
+ * Benchmarks the UI pipeline on synthetic trees, headless:
+ *
+ *     bench-ngui [--quick] [--filter <substring>] [--out <file.json>] [--font <file.ttf>] [--image <file>]
+ *
+ * Prints one JSON object with ops/sec and heap allocations per op for every
+ * benchmark, so runs can be diffed against each other in CI. Text is only
+ * benchmarked when given a font, and images when given an image.
+ */
+
+#include <ngui.h>
+#include <graph.h>
+#include <image.h>
+#include <list.h>
+#include <software.h>
+#include <text.h>
+#include <worker.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+std::atomic<unsigned long> allocations{0};
+
+}
+
+void *operator new(std::size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *memory = std::malloc(size ? size : 1))
+		return memory;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+using namespace ng::ui;
+
+namespace
+{
+
+struct Result
+{
+	std::string name;
+	int size;
+	unsigned long iterations;
+	double seconds;
+	unsigned long allocations;
+};
+
+std::vector<Result> results;
+double minimumTime = 0.5;
+const char *filter = nullptr;
+const char *font = nullptr;
+const char *imagePath = nullptr;
+
+/**
+ * Runs op over and over for at least minimumTime. setup runs before each op
+ * and teardown after it, neither is counted.
+ */
+template <typename Setup, typename Op, typename Teardown>
+void bench(const std::string &name, int size, Setup setup, Op op, Teardown teardown)
+{
+	if (filter && name.find(filter) == std::string::npos)
+		return;
+
+	using Clock = std::chrono::steady_clock;
+	Result result = {name, size, 0, 0, 0};
+
+	// One untimed run to warm caches and lazily started threads
+	setup();
+	op();
+	teardown();
+
+	while (result.seconds < minimumTime)
+	{
+		setup();
+		unsigned long before = allocations.load(std::memory_order_relaxed);
+		auto start = Clock::now();
+
+		op();
+
+		result.seconds += std::chrono::duration<double>(Clock::now() - start).count();
+		result.allocations += allocations.load(std::memory_order_relaxed) - before;
+		result.iterations++;
+		teardown();
+	}
+
+	results.push_back(result);
+	std::fprintf(stderr, "%-28s %6d %14.1f ops/s %10.1f allocs/op\n", name.c_str(), size,
+		result.iterations / result.seconds, double(result.allocations) / result.iterations);
+}
+
+template <typename Op>
+void bench(const std::string &name, int size, Op op)
+{
+	bench(name, size, [] {}, op, [] {});
+}
+
+// A card with a few properties and children, repeated until there are about count widgets
+std::string markup(int count)
+{
+	std::string xml = "<Widget direction=\"row\" padding=\"4\" spacing=\"2\">";
+	for (int i = 1; i < count; i += 3)
+	{
+		xml += "<Widget id=\"card" + std::to_string(i) + "\" padding=\"2\" grow=\"1\" direction=\"column\">"
+			"<Widget height=\"16\" label=\"Title " + std::to_string(i) + "\"/>"
+			"<Widget grow=\"2\" color=\"#336699\"/>"
+			"</Widget>";
+	}
+	return xml + "</Widget>";
+}
+
+std::string qdf(int count)
+{
+	std::string text = "Widget {\n\tdirection row\n\tpadding 4\n\tspacing 2\n";
+	for (int i = 1; i < count; i += 3)
+	{
+		text += "\tWidget {\n\t\tid card" + std::to_string(i) + "\n\t\tpadding 2\n\t\tgrow 1\n\t\tdirection column\n"
+			"\t\tWidget {\n\t\t\theight 16\n\t\t\tlabel \"Title " + std::to_string(i) + "\"\n\t\t}\n"
+			"\t\tWidget {\n\t\t\tgrow 2\n\t\t\tcolor \"#336699\"\n\t\t}\n"
+			"\t}\n";
+	}
+	return text + "}\n";
+}
+
+std::string writeTemp(const std::string &name, const std::string &contents)
+{
+	std::string path = (std::filesystem::temp_directory_path() / name).string();
+	std::ofstream(path) << contents;
+	return path;
+}
+
+void construction(Application &app, int size)
+{
+	std::string xml = markup(size);
+	std::string xmlPath = writeTemp("bench-ngui.xml", xml);
+	std::string qdfPath = writeTemp("bench-ngui.qdf", qdf(size));
+
+	Widget *tree = nullptr;
+	auto destroy = [&]
+	{
+		Widget::destroy(tree);
+		tree = nullptr;
+	};
+
+	bench("load/xml", size, [] {}, [&] { tree = app.fromFile(xmlPath.c_str()); }, destroy);
+	bench("load/qdf", size, [] {}, [&] { tree = app.fromQDF(qdfPath.c_str()); }, destroy);
+
+	pugi::xml_document document;
+	document.load_string(xml.c_str());
+	bench("build/markup", size, [] {}, [&] { tree = app.widgetFromMarkup(document.first_child(), new WidgetArena); }, destroy);
+
+	app.registerPrototype("bench", document.first_child());
+	bench("build/prototype", size, [] {}, [&] { tree = app.instantiate("bench"); }, destroy);
+
+	std::filesystem::remove(xmlPath);
+	std::filesystem::remove(qdfPath);
+}
+
+void properties(int size)
+{
+	auto *root = WidgetArena::createRoot<Widget>();
+	std::vector<Widget *> widgets;
+	for (int i = 0; i < size; i++)
+		widgets.push_back(&root->newChild<Widget>());
+
+	int notified = 0;
+	for (auto *widget : widgets)
+		widget->onChange("label", [&notified](std::string) { notified++; });
+
+	int round = 0;
+	bench("property/int", size, [&]
+	{
+		round++;
+		for (auto *widget : widgets)
+			widget->set("value", round);
+	});
+
+	bench("property/string", size, [&]
+	{
+		for (auto *widget : widgets)
+			widget->set("text", "some longer text that won't fit inline");
+	});
+
+	bench("property/notify", size, [&]
+	{
+		for (auto *widget : widgets)
+			widget->set("label", "changed");
+	});
+
+	bench("property/layout", size, [&]
+	{
+		round++;
+		for (auto *widget : widgets)
+			widget->set("grow", round % 3 + 1);
+	});
+
+	// A data feed setting the same properties over and over, notifying once each
+	bench("property/batch", size, [&]
+	{
+		{
+			PropertyBatch batch;
+			for (int i = 0; i < 20; i++)
+			{
+				for (auto *widget : widgets)
+					widget->set("label", i);
+			}
+		}
+		PropertyBatch::flush();
+	});
+
+	for (size_t i = 1; i < widgets.size(); i++)
+		widgets[i]->bind("value", widgets[i - 1], "value");
+
+	bench("property/binding", size, [&]
+	{
+		widgets[0]->set("value", ++round);
+	});
+
+	Widget::destroy(root);
+}
+
+void layout(Application &app, int size)
+{
+	pugi::xml_document document;
+	std::string xml = markup(size);
+	document.load_string(xml.c_str());
+	Widget *tree = app.widgetFromMarkup(document.first_child(), new WidgetArena);
+
+	int round = 0;
+	bench("layout/resize", size, [&]
+	{
+		round++;
+		tree->arrange(Box(0, 0, 1280 + round % 2, 720));
+	});
+
+	bench("layout/clean", size, [&]
+	{
+		tree->arrange(Box(0, 0, 1280, 720));
+	});
+
+	Widget::destroy(tree);
+}
+
+void render(Application &app, int size)
+{
+	pugi::xml_document document;
+	std::string xml = markup(size);
+	document.load_string(xml.c_str());
+
+	Window window("bench", RenderBackend::Software, {1280, 720});
+	window.setCentralWidget(app.widgetFromMarkup(document.first_child(), new WidgetArena));
+	window.update();
+
+	bench("render/full", size, [&]
+	{
+		window.invalidate();
+		window.update();
+	});
+
+	bench("render/damage", size, [&]
+	{
+		window.damage(Box(100, 100, 64, 64));
+		window.update();
+	});
+}
+
+// Scrolling through size * 100 rows should cost the same whatever size is
+void list(int size)
+{
+	Window window("bench", RenderBackend::Software, {1280, 720});
+	auto *root = WidgetArena::createRoot<Widget>();
+	auto &rows = root->newChild<VirtualList>();
+	rows.setItems(size * 100, &constructWidget<Widget>, [](Widget &row, size_t index)
+	{
+		row.set("label", static_cast<int>(index));
+	});
+	window.setCentralWidget(root);
+	window.update();
+
+	bench("list/scroll", size, [&]
+	{
+		rows.scrollTo((rows.getScroll() + 97) % rows.contentHeight());
+		window.update();
+	});
+}
+
+// size * 20 nodes in a grid, each with up to three edges to nodes a few columns on
+void graph(int size)
+{
+	Window window("bench", RenderBackend::Software, {1280, 720});
+	auto *root = WidgetArena::createRoot<Widget>();
+	auto &canvas = root->newChild<GraphCanvas>();
+
+	int nodes = size * 20;
+	int columns = 200;
+	canvas.reserve(nodes, nodes * 3);
+	for (int i = 0; i < nodes; i++)
+		canvas.addNode(i % columns * 160.0f, i / columns * 90.0f, 120, 60);
+	for (int i = 0; i < nodes; i++)
+	{
+		for (int j = 1; j <= 3; j++)
+		{
+			int to = i + j * 7 + columns * (j - 2);
+			if (to >= 0 && to < nodes)
+				canvas.addEdge(i, to);
+		}
+	}
+
+	window.setCentralWidget(root);
+	window.update();
+
+	int round = 0;
+	for (float zoom : {1.0f, 0.1f})
+	{
+		std::string name = zoom < 0.5f ? "graph/pan-far" : "graph/pan";
+		bench(name, size, [&]
+		{
+			round++;
+			canvas.setView(round % 400 * 8.0f, round % 300 * 4.0f, zoom);
+			window.update();
+		});
+	}
+
+	canvas.setView(0, 0, 1);
+	bench("graph/drag", size, [&]
+	{
+		round++;
+		canvas.moveNode(0, round % 50 * 2.0f, 0);
+		window.update();
+	});
+}
+
+// A column of size labels, most of them saying the same few things
+void text(int size)
+{
+	Window window("bench", RenderBackend::Software, {1280, 720});
+	auto *root = WidgetArena::createRoot<Widget>();
+	std::vector<Label *> labels;
+	for (int i = 0; i < size; i++)
+	{
+		auto &label = root->newChild<Label>();
+		label.set("font", font);
+		label.set("text", "Node " + std::to_string(i % 16));
+		labels.push_back(&label);
+	}
+	window.setCentralWidget(root);
+	window.update();
+
+	bench("text/render", size, [&]
+	{
+		window.invalidate();
+		window.update();
+	});
+
+	int round = 0;
+	bench("text/relabel", size, [&]
+	{
+		round++;
+		for (size_t i = 0; i < labels.size(); i++)
+			labels[i]->set("text", "Node " + std::to_string((i + round) % 16));
+		window.update();
+	});
+}
+
+// The image filling a 720x720 window, as in test/MainWindow.qdf
+void image()
+{
+	Window window("bench", RenderBackend::Software, {720, 720});
+	auto *root = WidgetArena::createRoot<Image>();
+	root->set("src", imagePath);
+	window.setCentralWidget(root);
+	window.update();
+
+	// The variant is made on a worker, wait for it to be drawn
+	for (int i = 0; i < 1000 && root->variantSize() != Size{720, 720}; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		WorkerPool::shared().runPosted();
+		window.update();
+	}
+	if (root->variantSize() != Size{720, 720})
+	{
+		std::fprintf(stderr, "Could not load %s\n", imagePath);
+		return;
+	}
+
+	bench("image/render", 1, [&]
+	{
+		window.invalidate();
+		window.update();
+	});
+}
+
+void writeJSON(FILE *out)
+{
+	std::fprintf(out, "{\n\t\"benchmarks\": [\n");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const Result &r = results[i];
+		std::fprintf(out,
+			"\t\t{\"name\": \"%s\", \"size\": %d, \"iterations\": %lu, \"ops_per_sec\": %.3f, \"ns_per_op\": %.1f, \"allocs_per_op\": %.2f}%s\n",
+			r.name.c_str(), r.size, r.iterations, r.iterations / r.seconds, r.seconds * 1e9 / r.iterations,
+			double(r.allocations) / r.iterations, i + 1 < results.size() ? "," : "");
+	}
+	std::fprintf(out, "\t]\n}\n");
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	const char *output = nullptr;
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--quick") == 0)
+			minimumTime = 0.05;
+		else if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+			filter = argv[++i];
+		else if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+			output = argv[++i];
+		else if (std::strcmp(argv[i], "--font") == 0 && i + 1 < argc)
+			font = argv[++i];
+		else if (std::strcmp(argv[i], "--image") == 0 && i + 1 < argc)
+			imagePath = argv[++i];
+		else
+		{
+			std::fprintf(stderr, "usage: %s [--quick] [--filter <substring>] [--out <file.json>] [--font <file.ttf>] [--image <file>]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	Application app;
+
+	for (int size : {10, 100, 1000})
+	{
+		construction(app, size);
+		properties(size);
+		layout(app, size);
+		render(app, size);
+		list(size);
+		graph(size);
+		if (font)
+			text(size);
+	}
+
+	if (imagePath)
+		image();
+
+	FILE *out = output ? std::fopen(output, "w") : stdout;
+	if (!out)
+	{
+		std::fprintf(stderr, "Could not write %s\n", output);
+		return 1;
+	}
+	writeJSON(out);
+	if (output)
+		std::fclose(out);
+}
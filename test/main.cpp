@@ -1,19 +1,31 @@
 #include <ngui.h>
-#include <image.h>
+#include <profiler.h>
+#include <MainWindow.h>
+#include <cstring>
 
 using namespace ng::ui;
 
 int main(int argc, char **argv)
 {
 	Application app;
-	// TODO: do this automatically
-	app.registerWidget<Widget>("Widget");
-	app.registerWidget<Image>("Image");
 
 	Window mainWindow("Node Graph UI test");
 
-	mainWindow.setCentralWidget(app.fromFile("../test/MainWindow.xml"));
+	// --compiled uses the tree ngui-compile generated from the same markup at build time
+	if (argc > 1 && std::strcmp(argv[1], "--compiled") == 0)
+		mainWindow.setCentralWidget(MainWindow());
+	else if (argc > 1 && std::strcmp(argv[1], "--qdf") == 0)
+		mainWindow.setCentralWidget(app.fromQDF("../test/MainWindow.qdf"));
+	else
+		mainWindow.setCentralWidget(app.watchFile("../test/MainWindow.xml"));
 
 	app.addWindow(&mainWindow);
+#ifdef NGUI_PROFILER
+	mainWindow.setProfilerOverlay(true);
+#endif
 	app.mainLoop();
+
+#ifdef NGUI_PROFILER
+	Profiler::shared().writeTrace("ngui-trace.json");
+#endif
 }
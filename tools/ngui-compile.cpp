@@ -0,0 +1,201 @@
+/**
+ * Compiles a markup file into C++ that builds the same widget tree directly,
+ * with no XML parsing or constructor lookups at runtime.
+ *
+ *     ngui-compile <markup> <output base> <function> [Tag=Class:header ...]
+ *
+ * Writes <output base>.h declaring `ng::ui::Widget *<function>()` and
+ * <output base>.cpp defining it. Widget, Image, Label, VirtualList and
+ * GraphCanvas are known already, any other element needs a Tag=Class:header
+ * mapping.
+ */
+
+#include <pugixml.hpp>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+
+namespace
+{
+
+struct WidgetType
+{
+	std::string className;
+	std::string header;
+};
+
+std::map<std::string, WidgetType> types = {
+	{"Widget", {"ng::ui::Widget", "ngui.h"}},
+	{"Image", {"ng::ui::Image", "image.h"}},
+	{"Label", {"ng::ui::Label", "text.h"}},
+	{"VirtualList", {"ng::ui::VirtualList", "list.h"}},
+	{"GraphCanvas", {"ng::ui::GraphCanvas", "graph.h"}},
+};
+
+std::set<std::string> headers;
+
+std::string quote(const char *text)
+{
+	std::string out = "\"";
+	for (const char *c = text; *c; c++)
+	{
+		switch (*c)
+		{
+		case '"':
+			out += "\\\"";
+			break;
+		case '\\':
+			out += "\\\\";
+			break;
+		case '\n':
+			out += "\\n";
+			break;
+		case '\t':
+			out += "\\t";
+			break;
+		default:
+			out += *c;
+		}
+	}
+	return out + "\"";
+}
+
+/**
+ * The value as a typed C++ literal, if assigning that gives exactly the same
+ * property as the string would, including its string form. Otherwise it's
+ * left as a string to be parsed at runtime.
+ */
+std::string literal(const char *value)
+{
+	std::string text = value;
+
+	if (text == "true" || text == "false")
+		return text;
+
+	if (!text.empty())
+	{
+		char *end = nullptr;
+		long number = std::strtol(value, &end, 10);
+		// Only what fits an int, anything bigger stays text and is parsed as a
+		// float at runtime. INT_MIN too, its literal is the negation of a long.
+		if (*end == 0 && std::to_string(number) == text && number > INT_MIN && number <= INT_MAX)
+			return text;
+
+		// Property writes colors back as lowercase #rrggbbaa
+		if (text.size() == 9 && text[0] == '#' && text.find_first_not_of("0123456789abcdef", 1) == std::string::npos)
+		{
+			unsigned long rgba = std::strtoul(value + 1, nullptr, 16);
+			std::ostringstream color;
+			color << "ng::ui::Color(" << (rgba >> 24) << ", " << ((rgba >> 16) & 0xff) << ", "
+				<< ((rgba >> 8) & 0xff) << ", " << (rgba & 0xff) << ")";
+			return color.str();
+		}
+	}
+
+	return quote(value);
+}
+
+int counter = 0;
+
+// Emits the statements building node and returns the variable holding it
+std::string compile(pugi::xml_node node, const std::string &parent, std::ostream &out)
+{
+	auto type = types.find(node.name());
+	if (type == types.end())
+		throw std::invalid_argument("Cannot find widget with name '" + std::string(node.name()) + "'");
+
+	headers.insert(type->second.header);
+
+	std::string name = "w" + std::to_string(counter++);
+	if (parent.empty())
+		out << "\tauto *" << name << " = ng::ui::WidgetArena::createRoot<" << type->second.className << ">();\n";
+	else
+		out << "\tauto *" << name << " = &" << parent << "->newChild<" << type->second.className << ">();\n";
+
+	for (auto &attr : node.attributes())
+		out << "\t" << name << "->set(" << quote(attr.name()) << ", " << literal(attr.value()) << ");\n";
+
+	for (auto &child : node.children())
+	{
+		if (child.type() == pugi::node_element)
+			compile(child, name, out);
+	}
+
+	return name;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 4)
+	{
+		std::cerr << "usage: " << argv[0] << " <markup> <output base> <function> [Tag=Class:header ...]" << std::endl;
+		return 1;
+	}
+
+	const char *input = argv[1];
+	std::string output = argv[2];
+	std::string function = argv[3];
+
+	for (int i = 4; i < argc; i++)
+	{
+		std::string mapping = argv[i];
+		size_t equals = mapping.find('=');
+		size_t colon = mapping.find(':', equals);
+		if (equals == std::string::npos || colon == std::string::npos)
+		{
+			std::cerr << "Bad widget mapping '" << mapping << "', expected Tag=Class:header" << std::endl;
+			return 1;
+		}
+		types[mapping.substr(0, equals)] = {mapping.substr(equals + 1, colon - equals - 1), mapping.substr(colon + 1)};
+	}
+
+	pugi::xml_document document;
+	if (!document.load_file(input))
+	{
+		std::cerr << "Could not load markup from " << input << std::endl;
+		return 1;
+	}
+
+	std::ostringstream body;
+	std::string root;
+	try
+	{
+		root = compile(document.document_element(), "", body);
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << input << ": " << e.what() << std::endl;
+		return 1;
+	}
+
+	std::ofstream header(output + ".h");
+	header << "// Generated by ngui-compile from " << input << ", do not edit\n"
+		<< "#pragma once\n\n"
+		<< "#include <ngui.h>\n\n"
+		<< "// The tree lives in its own arena, free it with ng::ui::Widget::destroy\n"
+		<< "ng::ui::Widget *" << function << "();\n";
+
+	std::ofstream source(output + ".cpp");
+	source << "// Generated by ngui-compile from " << input << ", do not edit\n";
+	for (const auto &h : headers)
+		source << "#include <" << h << ">\n";
+	source << "\nng::ui::Widget *" << function << "()\n{\n"
+		<< body.str()
+		<< "\treturn " << root << ";\n}\n";
+
+	if (!header || !source)
+	{
+		std::cerr << "Could not write " << output << ".h/.cpp" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
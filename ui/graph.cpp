@@ -0,0 +1,353 @@
+#include <graph.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace ng::ui
+{
+
+namespace
+{
+
+// Graph units per grid cell. Nodes are usually a good fraction of this, so
+// most sit in one or two cells and a screenful of view is a few dozen cells.
+constexpr int cellSize = 256;
+
+constexpr float minZoom = 0.02f;
+constexpr float maxZoom = 8.0f;
+// View scale per notch of the mouse wheel
+constexpr float wheelZoom = 1.2f;
+// Height of a node's title strip at zoom 1
+constexpr float headerHeight = 16.0f;
+// Edge thickness at zoom 1
+constexpr float edgeWidth = 2.0f;
+// How far edges run straight out of a node before bending, at the least
+constexpr float minimumBend = 40.0f;
+
+Color lighter(Color color)
+{
+	return Color(color.r + (255 - color.r) / 3, color.g + (255 - color.g) / 3, color.b + (255 - color.b) / 3, color.a);
+}
+
+Color darker(Color color)
+{
+	return Color(color.r / 2, color.g / 2, color.b / 2, color.a);
+}
+
+}
+
+GraphCanvas::GraphCanvas()
+	: nodeGrid(cellSize)
+	, edgeGrid(cellSize)
+{
+	set("clip", true);
+}
+
+void GraphCanvas::render(Box boundingBox, Renderer &renderer)
+{
+	renderer.fill(boundingBox, Color(28, 28, 32));
+
+	Box area(static_cast<int>(std::floor(viewX)), static_cast<int>(std::floor(viewY)),
+		static_cast<int>(std::ceil(boundingBox.w / zoom)) + 2, static_cast<int>(std::ceil(boundingBox.h / zoom)) + 2);
+
+	auto screen = [&](float x, float y)
+	{
+		Point local = toLocal(x, y);
+		return Point{boundingBox.x + local.x, boundingBox.y + local.y};
+	};
+
+	bool detailed = zoom >= detailZoom;
+	shownEdges = 0;
+	shownNodes = 0;
+
+	// Edges first, so nodes cover their ends. Curves are given in graph
+	// coordinates so their tessellations survive panning.
+	SDL_FPoint origin = {boundingBox.x - viewX * zoom, boundingBox.y - viewY * zoom};
+	edgeGrid.query(area, [&](EdgeId edge, const Box &)
+	{
+		Bezier curve = edgeCurve(edge);
+		if (detailed)
+		{
+			renderer.curve(curve, edgeWidth, edges.color[edge], zoom, origin);
+		}
+		else
+		{
+			Point a = screen(curve.x0, curve.y0);
+			Point b = screen(curve.x3, curve.y3);
+			if (std::abs(b.x - a.x) < 2 && std::abs(b.y - a.y) < 2)
+				return;
+			renderer.line(a, b, edges.color[edge]);
+		}
+		shownEdges++;
+	});
+
+	// In id order, so overlapping nodes stack the same way nodeAt() sees them
+	visible.clear();
+	nodeGrid.query(area, [&](NodeId node, const Box &)
+	{
+		visible.push_back(node);
+	});
+	std::sort(visible.begin(), visible.end());
+
+	for (NodeId node : visible)
+	{
+		Point at = screen(nodes.x[node], nodes.y[node]);
+		Box box(at.x, at.y, std::max(1, static_cast<int>(nodes.w[node] * zoom)),
+			std::max(1, static_cast<int>(nodes.h[node] * zoom)));
+		Color color = nodes.color[node];
+
+		renderer.fill(box, color);
+		if (detailed)
+		{
+			int header = std::min(box.h, static_cast<int>(headerHeight * zoom));
+			renderer.fill(Box(box.x, box.y, box.w, header), lighter(color));
+			renderer.rect(box, darker(color));
+		}
+	}
+	shownNodes = visible.size();
+}
+
+GraphCanvas::NodeId GraphCanvas::addNode(float x, float y, float w, float h, Color color)
+{
+	NodeId node = static_cast<NodeId>(nodes.x.size());
+	nodes.x.push_back(x);
+	nodes.y.push_back(y);
+	nodes.w.push_back(std::max(0.0f, w));
+	nodes.h.push_back(std::max(0.0f, h));
+	nodes.color.push_back(color);
+	nodes.incident.emplace_back();
+
+	nodeGrid.insert(node, nodeBounds(node));
+	invalidate();
+	return node;
+}
+
+GraphCanvas::EdgeId GraphCanvas::addEdge(NodeId from, NodeId to, Color color)
+{
+	if (from >= nodeCount() || to >= nodeCount())
+		throw std::out_of_range("Edge between nodes that don't exist");
+
+	EdgeId edge = static_cast<EdgeId>(edges.from.size());
+	edges.from.push_back(from);
+	edges.to.push_back(to);
+	edges.color.push_back(color);
+	edges.bounds.push_back(edgeBounds(edge));
+
+	nodes.incident[from].push_back(edge);
+	if (to != from)
+		nodes.incident[to].push_back(edge);
+
+	edgeGrid.insert(edge, edges.bounds[edge]);
+	invalidate();
+	return edge;
+}
+
+void GraphCanvas::moveNode(NodeId node, float x, float y)
+{
+	if (node >= nodeCount() || (nodes.x[node] == x && nodes.y[node] == y))
+		return;
+
+	Box before = nodeBounds(node);
+	nodes.x[node] = x;
+	nodes.y[node] = y;
+	nodeGrid.move(node, before, nodeBounds(node));
+
+	for (EdgeId edge : nodes.incident[node])
+	{
+		Box bounds = edgeBounds(edge);
+		edgeGrid.move(edge, edges.bounds[edge], bounds);
+		edges.bounds[edge] = bounds;
+	}
+
+	invalidate();
+}
+
+void GraphCanvas::reserve(size_t nodeCount, size_t edgeCount)
+{
+	nodes.x.reserve(nodeCount);
+	nodes.y.reserve(nodeCount);
+	nodes.w.reserve(nodeCount);
+	nodes.h.reserve(nodeCount);
+	nodes.color.reserve(nodeCount);
+	nodes.incident.reserve(nodeCount);
+
+	edges.from.reserve(edgeCount);
+	edges.to.reserve(edgeCount);
+	edges.color.reserve(edgeCount);
+	edges.bounds.reserve(edgeCount);
+}
+
+void GraphCanvas::clear()
+{
+	nodes = Nodes();
+	edges = Edges();
+	nodeGrid.clear();
+	edgeGrid.clear();
+	drag = Drag::None;
+	dragged = noNode;
+	invalidate();
+}
+
+void GraphCanvas::setView(float x, float y, float zoom)
+{
+	viewX = x;
+	viewY = y;
+	this->zoom = std::clamp(zoom, minZoom, maxZoom);
+	invalidate();
+}
+
+void GraphCanvas::pan(int dx, int dy)
+{
+	setView(viewX - dx / zoom, viewY - dy / zoom, zoom);
+}
+
+void GraphCanvas::zoomAt(Point local, float factor)
+{
+	float x, y;
+	toGraph(local, x, y);
+
+	float scale = std::clamp(zoom * factor, minZoom, maxZoom);
+	setView(x - local.x / scale, y - local.y / scale, scale);
+}
+
+Point GraphCanvas::toLocal(float x, float y) const
+{
+	return Point{static_cast<int>(std::floor((x - viewX) * zoom)), static_cast<int>(std::floor((y - viewY) * zoom))};
+}
+
+void GraphCanvas::toGraph(Point local, float &x, float &y) const
+{
+	x = viewX + local.x / zoom;
+	y = viewY + local.y / zoom;
+}
+
+GraphCanvas::NodeId GraphCanvas::nodeAt(Point local) const
+{
+	float x, y;
+	toGraph(local, x, y);
+
+	NodeId found = noNode;
+	Point cell{static_cast<int>(std::floor(x)), static_cast<int>(std::floor(y))};
+	nodeGrid.query(cell, [&](NodeId node, const Box &)
+	{
+		bool inside = x >= nodes.x[node] && x < nodes.x[node] + nodes.w[node]
+			&& y >= nodes.y[node] && y < nodes.y[node] + nodes.h[node];
+		if (inside && (found == noNode || node > found))
+			found = node;
+	});
+	return found;
+}
+
+void GraphCanvas::propertyChanged(const std::string &key, Property &prop)
+{
+	if (key == "detailZoom")
+	{
+		detailZoom = prop.toFloat();
+		invalidate();
+	}
+	else
+	{
+		Widget::propertyChanged(key, prop);
+	}
+}
+
+bool GraphCanvas::mouseEvent(const MouseEvent &event)
+{
+	if (Widget::mouseEvent(event))
+		return true;
+
+	switch (event.type)
+	{
+	case MouseEvent::Type::Press:
+	{
+		if (event.button != SDL_BUTTON_LEFT)
+			return false;
+
+		lastPointer = event.position;
+		dragged = nodeAt(event.local);
+		drag = dragged == noNode ? Drag::View : Drag::Node;
+		if (drag == Drag::Node)
+		{
+			float x, y;
+			toGraph(event.local, x, y);
+			grabX = x - nodes.x[dragged];
+			grabY = y - nodes.y[dragged];
+		}
+		return true;
+	}
+
+	case MouseEvent::Type::Move:
+	{
+		if (drag == Drag::View)
+		{
+			pan(event.position.x - lastPointer.x, event.position.y - lastPointer.y);
+		}
+		else if (drag == Drag::Node)
+		{
+			float x, y;
+			toGraph(event.local, x, y);
+			moveNode(dragged, x - grabX, y - grabY);
+		}
+		else
+		{
+			return false;
+		}
+
+		lastPointer = event.position;
+		return true;
+	}
+
+	case MouseEvent::Type::Release:
+		if (drag == Drag::None || event.button != SDL_BUTTON_LEFT)
+			return false;
+
+		drag = Drag::None;
+		dragged = noNode;
+		return true;
+
+	case MouseEvent::Type::Wheel:
+		if (event.wheelY == 0)
+			return false;
+
+		zoomAt(event.local, std::pow(wheelZoom, static_cast<float>(event.wheelY)));
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+Box GraphCanvas::nodeBounds(NodeId node) const
+{
+	int x = static_cast<int>(std::floor(nodes.x[node]));
+	int y = static_cast<int>(std::floor(nodes.y[node]));
+	return Box(x, y, static_cast<int>(std::ceil(nodes.w[node])) + 1, static_cast<int>(std::ceil(nodes.h[node])) + 1);
+}
+
+Box GraphCanvas::edgeBounds(EdgeId edge) const
+{
+	// The curve never leaves the hull of its control points. Half the width
+	// either side covers the thickness.
+	Bezier c = edgeCurve(edge);
+	float margin = edgeWidth / 2;
+	int left = static_cast<int>(std::floor(std::min({c.x0, c.x1, c.x2, c.x3}) - margin));
+	int top = static_cast<int>(std::floor(std::min({c.y0, c.y1, c.y2, c.y3}) - margin));
+	int right = static_cast<int>(std::ceil(std::max({c.x0, c.x1, c.x2, c.x3}) + margin));
+	int bottom = static_cast<int>(std::ceil(std::max({c.y0, c.y1, c.y2, c.y3}) + margin));
+	return Box(left, top, right - left + 1, bottom - top + 1);
+}
+
+Bezier GraphCanvas::edgeCurve(EdgeId edge) const
+{
+	NodeId from = edges.from[edge];
+	NodeId to = edges.to[edge];
+	float x1 = nodes.x[from] + nodes.w[from];
+	float y1 = nodes.y[from] + nodes.h[from] / 2;
+	float x2 = nodes.x[to];
+	float y2 = nodes.y[to] + nodes.h[to] / 2;
+
+	float bend = std::max(minimumBend, std::abs(x2 - x1) / 2);
+	return Bezier{x1, y1, x1 + bend, y1, x2 - bend, y2, x2, y2};
+}
+
+}
@@ -1,21 +1,474 @@
 #include <image.h>
+#include <profiler.h>
+#include <worker.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <list>
 
 namespace ng::ui
 {
 
+// A decode in flight. Dropping the last reference cancels it.
+struct Image::Decode
+{
+	~Decode()
+	{
+		if (surface)
+			SDL_FreeSurface(surface);
+	}
+
+	std::string path;
+	// Texture cache key of the variant, and the size it was asked for
+	std::string key;
+	Size size;
+	SDL_Surface *surface = nullptr;
+	bool done = false;
+	std::vector<Image *> waiting;
+
+	void finish(SDL_Surface *result)
+	{
+		surface = result;
+		done = true;
+		for (auto *image : waiting)
+			image->invalidate();
+	}
+};
+
+namespace
+{
+
+// Premultiplied ARGB, like the software renderer keeps it. Averaging these
+// doesn't bleed the color of transparent pixels into their neighbours.
+struct Pixels
+{
+	int w, h;
+	std::vector<uint32_t> pixels;
+
+	uint32_t *row(int y)
+	{
+		return pixels.data() + static_cast<size_t>(y) * w;
+	}
+
+	const uint32_t *row(int y) const
+	{
+		return pixels.data() + static_cast<size_t>(y) * w;
+	}
+};
+
+// Source pixels covering one destination pixel along an axis, and how much of
+// each. resample() never shrinks by 2 or more, so a span touches at most 3.
+struct Tap
+{
+	int first;
+	int count;
+	float weight[3];
+};
+
+// Frames a new size has to hold before it's worth a variant
+constexpr unsigned settleFrames = 2;
+
+std::string variantKey(const std::string &path, Size size)
+{
+	return path + "@" + std::to_string(size.w) + "x" + std::to_string(size.h);
+}
+
+Pixels premultiplied(SDL_Surface *surface)
+{
+	Pixels result{surface->w, surface->h, std::vector<uint32_t>(static_cast<size_t>(surface->w) * surface->h)};
+
+	SDL_LockSurface(surface);
+	for (int y = 0; y < surface->h; y++)
+	{
+		auto *src = reinterpret_cast<const uint32_t *>(static_cast<const char *>(surface->pixels) + y * surface->pitch);
+		uint32_t *dst = result.row(y);
+		for (int x = 0; x < surface->w; x++)
+		{
+			uint32_t p = src[x];
+			uint32_t a = p >> 24;
+			if (a != 255)
+			{
+				auto mul = [a](uint32_t c)
+				{
+					uint32_t t = c * a + 128;
+					return (t + (t >> 8)) >> 8;
+				};
+				p = (a << 24) | (mul((p >> 16) & 0xff) << 16) | (mul((p >> 8) & 0xff) << 8) | mul(p & 0xff);
+			}
+			dst[x] = p;
+		}
+	}
+	SDL_UnlockSurface(surface);
+
+	return result;
+}
+
+// One mip level down along either axis or both, averaging 2x2 blocks. An odd
+// last row or column is averaged with itself.
+Pixels halve(const Pixels &from, bool across, bool down)
+{
+	Pixels to{across ? (from.w + 1) / 2 : from.w, down ? (from.h + 1) / 2 : from.h, {}};
+	to.pixels.resize(static_cast<size_t>(to.w) * to.h);
+
+	// Two channels at a time, each sum of four fits in its 16 bits
+	constexpr uint32_t mask = 0x00ff00ff;
+	constexpr uint32_t round = 0x00020002;
+
+	for (int y = 0; y < to.h; y++)
+	{
+		const uint32_t *top = from.row(down ? 2 * y : y);
+		const uint32_t *bottom = from.row(down ? std::min(2 * y + 1, from.h - 1) : y);
+		uint32_t *dst = to.row(y);
+		for (int x = 0; x < to.w; x++)
+		{
+			int left = across ? 2 * x : x;
+			int right = across ? std::min(2 * x + 1, from.w - 1) : x;
+			uint32_t a = top[left], b = top[right], c = bottom[left], d = bottom[right];
+
+			uint32_t rb = ((a & mask) + (b & mask) + (c & mask) + (d & mask) + round) >> 2;
+			uint32_t ag = (((a >> 8) & mask) + ((b >> 8) & mask) + ((c >> 8) & mask) + ((d >> 8) & mask) + round) >> 2;
+			dst[x] = (rb & mask) | ((ag & mask) << 8);
+		}
+	}
+
+	return to;
+}
+
+std::vector<Tap> taps(int from, int to)
+{
+	std::vector<Tap> result(to);
+	float ratio = static_cast<float>(from) / to;
+	for (int i = 0; i < to; i++)
+	{
+		float start = i * ratio;
+		float end = std::min(static_cast<float>(from), (i + 1) * ratio);
+
+		Tap &tap = result[i];
+		tap.first = static_cast<int>(start);
+		tap.count = 0;
+		for (int j = tap.first; j < end && tap.count < 3; j++)
+			tap.weight[tap.count++] = (std::min(end, j + 1.0f) - std::max(start, static_cast<float>(j))) / ratio;
+	}
+	return result;
+}
+
+// The last step after halving, to exactly w by h. Each destination pixel is
+// the average of the source area under it.
+Pixels resample(const Pixels &from, int w, int h)
+{
+	Pixels to{w, h, std::vector<uint32_t>(static_cast<size_t>(w) * h)};
+	std::vector<Tap> across = taps(from.w, w);
+	std::vector<Tap> down = taps(from.h, h);
+
+	// The rows under one destination row blended together, as a, r, g, b
+	std::vector<float> blended(static_cast<size_t>(from.w) * 4);
+
+	for (int y = 0; y < h; y++)
+	{
+		std::fill(blended.begin(), blended.end(), 0.0f);
+		const Tap &vertical = down[y];
+		for (int k = 0; k < vertical.count; k++)
+		{
+			const uint32_t *src = from.row(vertical.first + k);
+			float weight = vertical.weight[k];
+			for (int x = 0; x < from.w; x++)
+			{
+				uint32_t p = src[x];
+				float *dst = &blended[x * 4];
+				dst[0] += (p >> 24) * weight;
+				dst[1] += ((p >> 16) & 0xff) * weight;
+				dst[2] += ((p >> 8) & 0xff) * weight;
+				dst[3] += (p & 0xff) * weight;
+			}
+		}
+
+		uint32_t *dst = to.row(y);
+		for (int x = 0; x < w; x++)
+		{
+			const Tap &horizontal = across[x];
+			float sum[4] = {0, 0, 0, 0};
+			for (int k = 0; k < horizontal.count; k++)
+			{
+				const float *src = &blended[(horizontal.first + k) * 4];
+				for (int c = 0; c < 4; c++)
+					sum[c] += src[c] * horizontal.weight[k];
+			}
+
+			// Rounding can leave a color a hair over alpha, which premultiplied can't have
+			uint32_t a = std::min(255u, static_cast<uint32_t>(sum[0] + 0.5f));
+			auto channel = [a](float value)
+			{
+				return std::min(a, static_cast<uint32_t>(value + 0.5f));
+			};
+			dst[x] = (a << 24) | (channel(sum[1]) << 16) | (channel(sum[2]) << 8) | channel(sum[3]);
+		}
+	}
+
+	return to;
+}
+
+// path decoded at full size and premultiplied. Null if it can't be decoded.
+std::shared_ptr<const Pixels> decodeSource(const std::string &path)
+{
+	SDL_Surface *decoded;
+	{
+		NGUI_PROFILE_SCOPE("Image decode");
+		decoded = IMG_Load(path.c_str());
+	}
+	if (!decoded)
+		return nullptr;
+
+	SDL_Surface *argb = SDL_ConvertSurfaceFormat(decoded, SDL_PIXELFORMAT_ARGB8888, 0);
+	SDL_FreeSurface(decoded);
+	if (!argb)
+		return nullptr;
+
+	auto source = std::make_shared<const Pixels>(premultiplied(argb));
+	SDL_FreeSurface(argb);
+	return source;
+}
+
+// source filtered down to fit size, never up
+SDL_Surface *loadVariant(const Pixels &source, Size size)
+{
+	NGUI_PROFILE_SCOPE("Image resample");
+	int w = std::min(size.w, source.w);
+	int h = std::min(size.h, source.h);
+
+	// Mip levels first, they're cheap and exact, then the rest of the way
+	const Pixels *pixels = &source;
+	Pixels filtered;
+	for (;;)
+	{
+		bool across = pixels->w > w && (pixels->w + 1) / 2 >= w;
+		bool down = pixels->h > h && (pixels->h + 1) / 2 >= h;
+		if (!across && !down)
+			break;
+		filtered = halve(*pixels, across, down);
+		pixels = &filtered;
+	}
+	if (pixels->w != w || pixels->h != h)
+	{
+		filtered = resample(*pixels, w, h);
+		pixels = &filtered;
+	}
+
+	SDL_Surface *variant = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_ARGB8888);
+	if (!variant)
+		return nullptr;
+
+	SDL_LockSurface(variant);
+	for (int y = 0; y < h; y++)
+		std::memcpy(static_cast<char *>(variant->pixels) + y * variant->pitch, pixels->row(y), w * sizeof(uint32_t));
+	SDL_UnlockSurface(variant);
+
+	return variant;
+}
+
+// Files most recently decoded, newest first, so a resize only filters them
+// down again. Only touched on the UI thread.
+constexpr size_t keptSources = 4;
+std::list<std::pair<std::string, std::shared_ptr<const Pixels>>> sources;
+
+std::shared_ptr<const Pixels> findSource(const std::string &path)
+{
+	for (auto it = sources.begin(); it != sources.end(); ++it)
+	{
+		if (it->first == path)
+		{
+			sources.splice(sources.begin(), sources, it);
+			return it->second;
+		}
+	}
+	return nullptr;
+}
+
+void keepSource(const std::string &path, std::shared_ptr<const Pixels> source)
+{
+	// Another size of the same file may have been decoded alongside
+	if (findSource(path))
+		return;
+
+	sources.emplace_front(path, std::move(source));
+	if (sources.size() > keptSources)
+		sources.pop_back();
+}
+
+// Decodes that are still running, so widgets showing the same file at the
+// same size share one
+std::unordered_map<std::string, std::weak_ptr<Image::Decode>> inFlight;
+
+std::shared_ptr<Image::Decode> startDecode(const std::string &path, Size size)
+{
+	std::string key = variantKey(path, size);
+	auto &slot = inFlight[key];
+	if (auto running = slot.lock(); running && !running->done)
+		return running;
+
+	auto decode = std::make_shared<Image::Decode>();
+	decode->path = path;
+	decode->key = key;
+	decode->size = size;
+	slot = decode;
+
+	std::weak_ptr<Image::Decode> weak = decode;
+	WorkerPool::shared().submit([weak, path, key, size, source = findSource(path)]
+	{
+		// Nobody wants it anymore
+		if (weak.expired())
+			return;
+
+		std::shared_ptr<const Pixels> decoded = source ? nullptr : decodeSource(path);
+		const Pixels *pixels = source ? source.get() : decoded.get();
+		SDL_Surface *surface = pixels ? loadVariant(*pixels, size) : nullptr;
+
+		WorkerPool::shared().post([weak, path, key, surface, decoded]
+		{
+			if (decoded)
+				keepSource(path, decoded);
+
+			auto it = inFlight.find(key);
+			if (it != inFlight.end() && it->second.expired())
+				inFlight.erase(it);
+
+			auto decode = weak.lock();
+			if (!decode)
+			{
+				if (surface)
+					SDL_FreeSurface(surface);
+				return;
+			}
+
+			inFlight.erase(key);
+			decode->finish(surface);
+		});
+	});
+
+	return decode;
+}
+
+}
+
+Image::Image() : Widget(), self(std::make_shared<Image *>(this))
+{
+	onChange("src", [this](std::string path)
+	{
+		load(std::move(path));
+	});
+}
+
+Image::~Image()
+{
+	cancel();
+}
+
+void Image::load(std::string path)
+{
+	if (path == src && !failed)
+		return;
+
+	cancel();
+	texture = Texture();
+	shown = Size{0, 0};
+	failed = false;
+	src = std::move(path);
+}
+
+void Image::request(Size size, Renderer &renderer)
+{
+	if (decode && decode->size == size)
+		return;
+
+	if (Texture cached = renderer.textureCache().find(variantKey(src, size)))
+	{
+		cancel();
+		texture = cached;
+		shown = size;
+		generation = renderer.textureGeneration();
+		return;
+	}
+
+	// Mid resize the old variant stretches fine, rather than one per frame
+	if (texture && !settled(size))
+		return;
+
+	cancel();
+	decode = startDecode(src, size);
+	decode->waiting.push_back(this);
+}
+
+bool Image::settled(Size size)
+{
+	if (size != settling)
+	{
+		settling = size;
+		settledFrames = 0;
+	}
+	if (settledFrames++ >= settleFrames)
+		return true;
+
+	// Come back next frame even if nothing else changes. Queued, since the
+	// window counts anything invalidated while drawing as drawn.
+	WorkerPool::shared().post([weak = std::weak_ptr<Image *>(self)]
+	{
+		if (auto image = weak.lock())
+			(*image)->invalidate();
+	});
+	return false;
+}
+
+void Image::cancel()
+{
+	if (!decode)
+		return;
+
+	auto &waiting = decode->waiting;
+	waiting.erase(std::remove(waiting.begin(), waiting.end(), this), waiting.end());
+	decode.reset();
+}
+
 void Image::render(Box boundingBox, Renderer &renderer)
 {
-	std::cerr << boundingBox.w << " " << boundingBox.h << std::endl;
+	// Gone with the device
+	if (texture && generation != renderer.textureGeneration())
+	{
+		texture = Texture();
+		shown = Size{0, 0};
+	}
 
-	if (!textureLoaded)
+	Size size = {boundingBox.w, boundingBox.h};
+	if (!src.empty() && !failed && !boundingBox.empty() && size != shown)
+		request(size, renderer);
+
+	if (decode && decode->done)
 	{
-		auto img = get<std::string>("src");
-		texture = renderer.loadImage(img.c_str());
-		textureLoaded = true;
+		if (decode->surface)
+		{
+			// Anything else waiting on the same variant may have uploaded it already
+			TextureCache &cache = renderer.textureCache();
+			texture = cache.find(decode->key);
+			if (!texture)
+			{
+				texture = renderer.textureFromPremultiplied(decode->surface);
+				cache.insert(decode->key, texture);
+			}
+			shown = decode->size;
+			generation = renderer.textureGeneration();
+		}
+		else
+		{
+			std::cerr << "Could not load image from path '" << src << "'" << std::endl;
+			failed = true;
+		}
+
+		cancel();
 	}
 
-	renderer.texture(texture, boundingBox);
+	if (texture)
+		renderer.texture(texture, boundingBox);
+	else
+		renderer.fill(boundingBox, Color(40, 40, 40));
 }
 
 }
@@ -0,0 +1,353 @@
+#include <list.h>
+#include <algorithm>
+
+namespace ng::ui
+{
+
+namespace
+{
+
+// Rows scrolled per notch of the mouse wheel
+constexpr int wheelRows = 3;
+
+size_t lowestBit(size_t i)
+{
+	return i & (~i + 1);
+}
+
+// Only plain functions like constructWidget<T> can be told apart
+bool sameFactory(const VirtualList::ItemFactory &a, const VirtualList::ItemFactory &b)
+{
+	using Function = Widget *(*)(WidgetArena *);
+	const Function *x = a.target<Function>();
+	const Function *y = b.target<Function>();
+	return x && y && *x == *y;
+}
+
+}
+
+VirtualList::VirtualList()
+{
+	set("clip", true);
+}
+
+VirtualList::~VirtualList()
+{
+	// Shown items are children and go with the rest of them. Spares are made
+	// from this list's arena after the list itself, so an arena teardown
+	// hasn't reached them yet either.
+	for (Widget *item : spare)
+		destroy(item);
+}
+
+void VirtualList::setItems(size_t count, ItemFactory create, ItemBinder bind)
+{
+	if (sameFactory(this->create, create))
+		recycleItems();
+	else
+		clearItems();
+
+	this->create = std::move(create);
+	resetItems(count, std::move(bind));
+}
+
+void VirtualList::setItems(size_t count, ItemBinder bind)
+{
+	recycleItems();
+	resetItems(count, std::move(bind));
+}
+
+void VirtualList::resetItems(size_t count, ItemBinder bind)
+{
+	this->bind = std::move(bind);
+	this->count = count;
+	extra.clear();
+	scroll = 0;
+
+	layoutItems();
+	invalidate();
+}
+
+void VirtualList::setCount(size_t count)
+{
+	size_t before = rows();
+	this->count = count;
+	resizeRows(before);
+
+	scroll = std::clamp(scroll, 0, std::max(0, contentHeight() - viewport.h));
+	layoutItems();
+	invalidate();
+}
+
+void VirtualList::refresh()
+{
+	for (const Shown &item : shown)
+		bind(*item.widget, item.index);
+}
+
+void VirtualList::refresh(size_t index)
+{
+	for (const Shown &item : shown)
+	{
+		if (item.index == index)
+			bind(*item.widget, item.index);
+	}
+}
+
+void VirtualList::setRowHeight(size_t row, int height)
+{
+	if (row >= rows())
+		return;
+
+	height = std::max(0, height);
+	if (extra.empty())
+	{
+		if (height == rowHeight)
+			return;
+		extra.assign(rows() + 1, 0);
+	}
+
+	int delta = height - getRowHeight(row);
+	for (size_t i = row + 1; i < extra.size(); i += lowestBit(i))
+		extra[i] += delta;
+
+	layoutItems();
+	invalidate();
+}
+
+int VirtualList::getRowHeight(size_t row) const
+{
+	if (extra.empty())
+		return rowHeight;
+	return rowHeight + extraBefore(row + 1) - extraBefore(row);
+}
+
+int VirtualList::rowOffset(size_t row) const
+{
+	row = std::min(row, rows());
+	int offset = static_cast<int>(row) * rowHeight;
+	return extra.empty() ? offset : offset + extraBefore(row);
+}
+
+size_t VirtualList::rowAt(int y) const
+{
+	size_t n = rows();
+	if (n == 0 || y <= 0)
+		return 0;
+
+	if (extra.empty())
+		return std::min(static_cast<size_t>(y / rowHeight), n - 1);
+
+	// Walks down the tree, taking each span of rows that still ends above y
+	size_t row = 0;
+	size_t step = 1;
+	while (step * 2 <= n)
+		step *= 2;
+
+	for (; step > 0; step /= 2)
+	{
+		size_t next = row + step;
+		if (next > n)
+			continue;
+
+		int height = static_cast<int>(step) * rowHeight + extra[next];
+		if (height <= y)
+		{
+			row = next;
+			y -= height;
+		}
+	}
+
+	return std::min(row, n - 1);
+}
+
+void VirtualList::scrollTo(int y)
+{
+	y = std::clamp(y, 0, std::max(0, contentHeight() - viewport.h));
+	if (y == scroll)
+		return;
+
+	scroll = y;
+	layoutItems();
+	invalidate();
+}
+
+void VirtualList::scrollToRow(size_t row)
+{
+	int top = rowOffset(row);
+	int bottom = top + getRowHeight(row);
+	if (top < scroll)
+		scrollTo(top);
+	else if (bottom > scroll + viewport.h)
+		scrollTo(bottom - viewport.h);
+}
+
+Size VirtualList::measureContent(Size available)
+{
+	// However much space it gets, never what the items would add up to
+	return Size{0, 0};
+}
+
+void VirtualList::arrangeContent(Size size)
+{
+	viewport = size;
+	scroll = std::clamp(scroll, 0, std::max(0, contentHeight() - viewport.h));
+	layoutItems();
+}
+
+void VirtualList::propertyChanged(const std::string &key, Property &prop)
+{
+	// Either changes what the per-row heights mean, so they're dropped
+	if (key == "rowHeight")
+		rowHeight = std::max(1, prop.toInt());
+	else if (key == "columns")
+		columns = std::max(1, prop.toInt());
+	else
+	{
+		Widget::propertyChanged(key, prop);
+		return;
+	}
+
+	extra.clear();
+	invalidateLayout();
+}
+
+bool VirtualList::mouseEvent(const MouseEvent &event)
+{
+	if (Widget::mouseEvent(event))
+		return true;
+
+	if (event.type != MouseEvent::Type::Wheel || event.wheelY == 0)
+		return false;
+
+	int before = scroll;
+	scrollTo(scroll - event.wheelY * wheelRows * rowHeight);
+
+	// Once it can't scroll any further the wheel goes to whatever is outside
+	return scroll != before;
+}
+
+int VirtualList::extraBefore(size_t n) const
+{
+	int sum = 0;
+	for (; n > 0; n -= lowestBit(n))
+		sum += extra[n];
+	return sum;
+}
+
+void VirtualList::resizeRows(size_t before)
+{
+	if (extra.empty())
+		return;
+
+	size_t after = rows();
+	if (after <= before)
+	{
+		// Each node only covers rows up to its own index, so the rest stay right
+		extra.resize(after + 1);
+		return;
+	}
+
+	// New rows are rowHeight, but new nodes can cover old rows too
+	extra.resize(after + 1, 0);
+	int total = extraBefore(before);
+	for (size_t i = before + 1; i <= after; i++)
+	{
+		size_t start = i - lowestBit(i);
+		if (start < before)
+			extra[i] = total - extraBefore(start);
+	}
+}
+
+void VirtualList::layoutItems()
+{
+	size_t first = 0;
+	size_t last = 0;
+	if (create && count > 0 && viewport.w > 0 && viewport.h > 0)
+	{
+		first = rowAt(scroll) * columns;
+		last = std::min(count, (rowAt(scroll + viewport.h - 1) + 1) * columns);
+	}
+
+	// Whatever scrolled out is kept for what scrolls in
+	for (size_t i = 0; i < shown.size();)
+	{
+		if (shown[i].index >= first && shown[i].index < last)
+		{
+			i++;
+			continue;
+		}
+
+		removeChild(shown[i].widget);
+		spare.push_back(shown[i].widget);
+		shown[i] = shown.back();
+		shown.pop_back();
+	}
+
+	std::sort(shown.begin(), shown.end(), [](const Shown &a, const Shown &b)
+	{
+		return a.index < b.index;
+	});
+
+	size_t existing = shown.size();
+	size_t next = 0;
+	for (size_t index = first; index < last; index++)
+	{
+		if (next < existing && shown[next].index == index)
+		{
+			next++;
+			continue;
+		}
+
+		Widget *item;
+		if (!spare.empty())
+		{
+			item = spare.back();
+			spare.pop_back();
+		}
+		else
+		{
+			item = create(getArena());
+		}
+
+		bind(*item, index);
+		addChild(item);
+		shown.push_back(Shown{index, item});
+	}
+
+	int columnWidth = viewport.w / columns;
+	for (const Shown &item : shown)
+	{
+		size_t row = item.index / columns;
+		int column = static_cast<int>(item.index % columns);
+		int x = column * columnWidth;
+		int width = column == columns - 1 ? viewport.w - x : columnWidth;
+		item.widget->arrange(Box(x, rowOffset(row) - scroll, width, getRowHeight(row)));
+	}
+}
+
+void VirtualList::clearItems()
+{
+	for (const Shown &item : shown)
+	{
+		removeChild(item.widget);
+		destroy(item.widget);
+	}
+	shown.clear();
+
+	for (Widget *item : spare)
+		destroy(item);
+	spare.clear();
+}
+
+void VirtualList::recycleItems()
+{
+	for (const Shown &item : shown)
+	{
+		removeChild(item.widget);
+		spare.push_back(item.widget);
+	}
+	shown.clear();
+}
+
+}
@@ -1,5 +1,22 @@
 #include <ngui.h>
+#include <graph.h>
+#include <image.h>
+#include <list.h>
+#include <profiler.h>
+#include <software.h>
+#include <spatial.h>
+#include <text.h>
+#include <watcher.h>
+#include <worker.h>
+#include <SDL2/SDL_ttf.h>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <unordered_set>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 namespace ng::ui
 {
@@ -9,34 +26,324 @@ SDL_Rect Box::toSDLRect()
 	return SDL_Rect{x, y, w, h};
 }
 
+Box Box::united(const Box &other) const
+{
+	if (empty())
+		return other;
+	if (other.empty())
+		return *this;
+
+	int left = std::min(x, other.x);
+	int top = std::min(y, other.y);
+	int right = std::max(x + w, other.x + other.w);
+	int bottom = std::max(y + h, other.y + other.h);
+	return Box(left, top, right - left, bottom - top);
+}
+
+Box Box::intersected(const Box &other) const
+{
+	int left = std::max(x, other.x);
+	int top = std::max(y, other.y);
+	int right = std::min(x + w, other.x + other.w);
+	int bottom = std::min(y + h, other.y + other.h);
+	if (right <= left || bottom <= top)
+		return Box();
+	return Box(left, top, right - left, bottom - top);
+}
+
 Application::Application()
 {
-	SDL_Init(SDL_INIT_VIDEO);
+	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER);
 	IMG_Init(IMG_INIT_JPG | IMG_INIT_PNG);
+	TTF_Init();
+	// Windows are paced by the main loop, a present blocking on vsync would
+	// hold up every other window behind it
+	SDL_SetHint(SDL_HINT_RENDER_VSYNC, "0");
+	wakeEvent = SDL_RegisterEvents(1);
+
+	WorkerPool::shared().setWakeup([this]
+	{
+		wake();
+	});
 }
 
 Application::~Application()
 {
+	watcher.reset();
+	WorkerPool::shared().setWakeup(nullptr);
+
+	for (auto &timer : timers)
+		SDL_RemoveTimer(timer.sdlTimer);
+
 	IMG_Quit();
+	TTF_Quit();
 	SDL_Quit();
 }
 
 void Application::addWindow(Window *win)
 {
 	windows.push_back(win);
+	win->invalidate();
 }
 
-[[noreturn]]
 void Application::mainLoop()
 {
-	while (true)
+	running = true;
+	while (processEvents(-1));
+}
+
+bool Application::processEvents(int timeout)
+{
+	// Sleep no longer than until the next frame some window is waiting on.
+	// Windows with nothing to draw don't count.
+	Uint64 now = SDL_GetPerformanceCounter();
+	for (auto *win : windows)
+	{
+		int wait = win->msUntilFrame(now);
+		if (wait >= 0 && (timeout < 0 || wait < timeout))
+			timeout = wait;
+	}
+
+	SDL_Event event;
+	int got = timeout < 0 ? SDL_WaitEvent(&event) : SDL_WaitEventTimeout(&event, timeout);
+
+	// Drain the whole queue before drawing so a burst of events costs one frame
+	while (got && running)
+	{
+		handleEvent(event);
+		got = SDL_PollEvent(&event);
+	}
+
+	if (!running)
+		return false;
+
+	// Results from background work, e.g. decoded images
+	WorkerPool::shared().runPosted();
+
+	// Everything batched since the last frame, before any window lays out
+	PropertyBatch::flush();
+
+	// Each window on its own schedule, the rest stay dirty until they're due
+	now = SDL_GetPerformanceCounter();
+	for (auto *win : windows)
+	{
+		if (win->frameDue(now))
+			win->update();
+	}
+
+	return running;
+}
+
+void Application::quit()
+{
+	running = false;
+	wake();
+}
+
+void Application::wake()
+{
+	SDL_Event event = {};
+	event.type = wakeEvent;
+	SDL_PushEvent(&event);
+}
+
+void Application::addTimer(Uint32 interval, std::function<bool ()> callback)
+{
+	// SDL_RemoveTimer() doesn't wait for a callback that's already running,
+	// so the timer thread only gets values and never touches a Timer. Event
+	// types fit in 16 bits, which leaves the rest for the id.
+	uintptr_t id = nextTimerId++ & (UINTPTR_MAX >> 16);
+	uintptr_t param = (id << 16) | wakeEvent;
+
+	auto &timer = timers.emplace_back(Timer{id, 0, std::move(callback)});
+	timer.sdlTimer = SDL_AddTimer(interval, timerFired, reinterpret_cast<void *>(param));
+}
+
+// Runs on SDL's timer thread, so just forward it to the event queue
+Uint32 Application::timerFired(Uint32 interval, void *param)
+{
+	auto packed = reinterpret_cast<uintptr_t>(param);
+
+	SDL_Event event = {};
+	event.type = static_cast<Uint32>(packed & 0xffff);
+	event.user.data1 = reinterpret_cast<void *>(packed >> 16);
+	SDL_PushEvent(&event);
+
+	return interval;
+}
+
+void Application::handleEvent(const SDL_Event &event)
+{
+	if (event.type == wakeEvent)
+	{
+		if (!event.user.data1)
+			return;
+
+		// The timer may have been cancelled while this event was queued
+		auto id = reinterpret_cast<uintptr_t>(event.user.data1);
+		for (auto it = timers.begin(); it != timers.end(); ++it)
+		{
+			if (it->id != id)
+				continue;
+
+			if (!it->callback())
+			{
+				SDL_RemoveTimer(it->sdlTimer);
+				timers.erase(it);
+			}
+			break;
+		}
+		return;
+	}
+
+	switch (event.type)
 	{
+	case SDL_QUIT:
+		running = false;
+		break;
+
+	case SDL_WINDOWEVENT:
+		if (auto *win = windowById(event.window.windowID))
+		{
+			if (event.window.event == SDL_WINDOWEVENT_CLOSE)
+			{
+				// Off screen rather than left there frozen, now that nothing updates it
+				if (win->window)
+					SDL_HideWindow(win->window);
+				windows.remove(win);
+				if (windows.empty())
+					running = false;
+
+				// Last, since the owner may well destroy it
+				if (win->closeHandler)
+					win->closeHandler();
+			}
+			else
+			{
+				win->handleEvent(event);
+			}
+		}
+		break;
+
+	// Whatever was drawn into the backbuffers is gone, so only repainting the
+	// damage would leave garbage everywhere else
+	case SDL_RENDER_TARGETS_RESET:
+	case SDL_RENDER_DEVICE_RESET:
 		for (auto *win : windows)
+			win->targetsLost(event.type == SDL_RENDER_DEVICE_RESET);
+		break;
+
+	case SDL_MOUSEMOTION:
+		if (auto *win = windowById(event.motion.windowID))
+			win->handleEvent(event);
+		break;
+
+	case SDL_MOUSEBUTTONDOWN:
+	case SDL_MOUSEBUTTONUP:
+		if (auto *win = windowById(event.button.windowID))
+			win->handleEvent(event);
+		break;
+
+	case SDL_MOUSEWHEEL:
+		if (auto *win = windowById(event.wheel.windowID))
+			win->handleEvent(event);
+		break;
+
+	case SDL_KEYDOWN:
+	case SDL_KEYUP:
+		if (auto *win = windowById(event.key.windowID))
+			win->handleEvent(event);
+		break;
+
+	case SDL_TEXTINPUT:
+		if (auto *win = windowById(event.text.windowID))
+			win->handleEvent(event);
+		break;
+
+	default:
+		break;
+	}
+}
+
+Window *Application::windowById(Uint32 id)
+{
+	for (auto *win : windows)
+	{
+		if (win->window && SDL_GetWindowID(win->window) == id)
+			return win;
+	}
+	return nullptr;
+}
+
+WidgetRegistry &WidgetRegistry::shared()
+{
+	static WidgetRegistry registry;
+	return registry;
+}
+
+WidgetRegistry::WidgetRegistry()
+	: slots(64)
+{
+	// Registered here rather than with NGUI_REGISTER_WIDGET, which a static
+	// library would drop along with the otherwise unreferenced object file
+	add("Widget", hashName("Widget"), &constructWidget<Widget>);
+	add("Image", hashName("Image"), &constructWidget<Image>);
+	add("Label", hashName("Label"), &constructWidget<Label>);
+	add("VirtualList", hashName("VirtualList"), &constructWidget<VirtualList>);
+	add("GraphCanvas", hashName("GraphCanvas"), &constructWidget<GraphCanvas>);
+}
+
+WidgetRegistry::Slot &WidgetRegistry::slot(std::string_view name, uint32_t hash)
+{
+	size_t mask = slots.size() - 1;
+	for (size_t i = hash & mask;; i = (i + 1) & mask)
+	{
+		Slot &candidate = slots[i];
+		if (candidate.name.empty() || (candidate.hash == hash && candidate.name == name))
+			return candidate;
+	}
+}
+
+bool WidgetRegistry::add(std::string_view name, uint32_t hash, WidgetConstructor construct)
+{
+	// Empty names mark free slots
+	if (name.empty())
+		throw std::invalid_argument("Widget names can't be empty");
+
+	Slot *entry = &slot(name, hash);
+	if (entry->name.empty())
+	{
+		if ((count + 1) * 2 > slots.size())
 		{
-			win->update();
+			std::vector<Slot> old(slots.size() * 2);
+			old.swap(slots);
+			for (const Slot &moved : old)
+			{
+				if (!moved.name.empty())
+					slot(moved.name, moved.hash) = moved;
+			}
+			entry = &slot(name, hash);
 		}
-		// For debugging
-		SDL_Delay(100);
+
+		entry->hash = hash;
+		entry->name = names.emplace_back(name);
+		count++;
+	}
+
+	entry->construct = construct;
+	return true;
+}
+
+const WidgetRegistry::Entry *WidgetRegistry::lookup(std::string_view name, uint32_t hash) const
+{
+	size_t mask = slots.size() - 1;
+	for (size_t i = hash & mask;; i = (i + 1) & mask)
+	{
+		const Slot &candidate = slots[i];
+		if (candidate.name.empty())
+			return nullptr;
+		if (candidate.hash == hash && candidate.name == name)
+			return &candidate;
 	}
 }
 
@@ -48,13 +355,22 @@ Widget *Application::fromFile(const char *path)
 	{
 		throw std::invalid_argument("Could not load widget from path");
 	}
-	return widgetFromMarkup(document.root().first_child());
+
+	auto *arena = new WidgetArena;
+	try
+	{
+		return widgetFromMarkup(document.root().first_child(), arena);
+	}
+	catch (...)
+	{
+		delete arena;
+		throw;
+	}
 }
 
-Widget *Application::widgetFromMarkup(pugi::xml_node doc)
+Widget *Application::widgetFromMarkup(pugi::xml_node doc, WidgetArena *arena)
 {
-	std::cerr << doc.name() << std::endl;
-	auto *widget = widgetByName<Widget>(doc.name());
+	auto *widget = widgetByName<Widget>(doc.name(), arena);
 	populateFromMarkup(widget, doc);
 	return widget;
 }
@@ -68,106 +384,2714 @@ void Application::populateFromMarkup(Widget *widget, pugi::xml_node doc)
 
 	for (auto &child : doc.children())
 	{
-		widget->addChild(widgetFromMarkup(child));
+		widget->addChild(widgetFromMarkup(child, widget->getArena()));
 	}
 }
 
-Window::Window(const char *name)
+namespace
 {
-	window = SDL_CreateWindow(name, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 720, 720,
-		SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
-	renderer = new Renderer(this);
+
+std::vector<pugi::xml_node> elements(pugi::xml_node parent)
+{
+	std::vector<pugi::xml_node> children;
+	for (auto &child : parent.children())
+	{
+		if (child.type() == pugi::node_element)
+			children.push_back(child);
+	}
+	return children;
 }
 
-Window::~Window()
+// First element in doc that isn't a registered widget, if any
+pugi::xml_node unknownWidget(pugi::xml_node doc)
 {
-	if (central)
-		delete central;
-	if (window)
-		SDL_DestroyWindow(window);
-	if (renderer)
-		delete renderer;
+	if (!WidgetRegistry::shared().find(doc.name()))
+		return doc;
+
+	for (auto &child : elements(doc))
+	{
+		if (auto unknown = unknownWidget(child))
+			return unknown;
+	}
+	return pugi::xml_node();
 }
 
-Renderer::Renderer(Window *win)
+}
+
+Widget *Application::watchFile(const char *path)
 {
-	window = win;
-	renderer = SDL_CreateRenderer(win->window, -1, SDL_RENDERER_ACCELERATED);
+	auto document = std::make_shared<pugi::xml_document>();
+	if (!document->load_file(path))
+	{
+		throw std::invalid_argument("Could not load widget from path");
+	}
+
+	auto *arena = new WidgetArena;
+	Widget *root;
+	try
+	{
+		root = widgetFromMarkup(document->root().first_child(), arena);
+	}
+	catch (...)
+	{
+		delete arena;
+		throw;
+	}
+
+	if (!watcher)
+		watcher = std::make_unique<FileWatcher>();
+
+	std::string file = path;
+	watched.push_back({file, root, std::move(document)});
+	watcher->watch(file, [this, file]
+	{
+		reload(file);
+	});
+	return root;
 }
 
-Renderer::~Renderer()
+void Application::unwatch(Widget *root)
 {
-	SDL_DestroyRenderer(renderer);
+	std::string path;
+	for (auto it = watched.begin(); it != watched.end(); ++it)
+	{
+		if (it->root == root)
+		{
+			path = it->path;
+			watched.erase(it);
+			break;
+		}
+	}
+
+	if (path.empty())
+		return;
+
+	for (const auto &file : watched)
+	{
+		if (file.path == path)
+			return;
+	}
+	watcher->unwatch(path);
 }
 
-void Renderer::clear()
+void Application::reload(const std::string &path)
 {
-	SDL_RenderClear(renderer);
+	auto document = std::make_shared<pugi::xml_document>();
+	if (!document->load_file(path.c_str()))
+	{
+		// Likely caught halfway through a save, the next write will be along shortly
+		std::cerr << "Could not reload " << path << std::endl;
+		return;
+	}
+
+	// Checked up front so a bad edit doesn't leave the tree half patched
+	pugi::xml_node doc = document->root().first_child();
+	if (auto unknown = unknownWidget(doc))
+	{
+		std::cerr << path << ": cannot find widget with name '" << unknown.name() << "'" << std::endl;
+		return;
+	}
+
+	for (auto &file : watched)
+	{
+		if (file.path != path)
+			continue;
+
+		if (file.root->tag != doc.name())
+		{
+			std::cerr << path << ": the root element can't change type without a restart" << std::endl;
+			continue;
+		}
+
+		patchFromMarkup(file.root, file.document->root().first_child(), doc);
+		file.document = document;
+	}
 }
 
-void Renderer::present()
+void Application::patchFromMarkup(Widget *widget, pugi::xml_node old, pugi::xml_node doc)
 {
-	SDL_RenderPresent(renderer);
+	// Only what the markup changed, so values set from code since survive
+	for (auto &attr : doc.attributes())
+	{
+		pugi::xml_attribute before = old.attribute(attr.name());
+		if (!before || std::strcmp(before.value(), attr.value()) != 0)
+			widget->set(attr.name(), attr.value());
+	}
+
+	for (auto &attr : old.attributes())
+	{
+		if (!doc.attribute(attr.name()))
+			widget->set(attr.name(), "");
+	}
+
+	std::vector<pugi::xml_node> before = elements(old);
+	std::vector<pugi::xml_node> after = elements(doc);
+
+	if (before.size() != widget->children.size())
+	{
+		// Children were added from code too, so positions can't be trusted
+		std::cerr << "Not reloading the children of " << doc.name() << ", they don't match the markup" << std::endl;
+		return;
+	}
+
+	std::unordered_map<std::string_view, size_t> byId;
+	for (size_t i = 0; i < before.size(); i++)
+	{
+		std::string_view id = before[i].attribute("id").value();
+		if (!id.empty())
+			byId.emplace(id, i);
+	}
+
+	std::vector<Widget *> current = std::move(widget->children);
+	widget->children.clear();
+	std::vector<bool> kept(current.size(), false);
+
+	for (size_t i = 0; i < after.size(); i++)
+	{
+		size_t match = current.size();
+		std::string_view id = after[i].attribute("id").value();
+		if (!id.empty())
+		{
+			auto found = byId.find(id);
+			if (found != byId.end())
+				match = found->second;
+		}
+		else if (i < before.size() && !*before[i].attribute("id").value())
+		{
+			match = i;
+		}
+
+		if (match < current.size() && !kept[match] && std::strcmp(before[match].name(), after[i].name()) == 0)
+		{
+			kept[match] = true;
+			patchFromMarkup(current[match], before[match], after[i]);
+			current[match]->childIndex = widget->children.size();
+			widget->children.push_back(current[match]);
+		}
+		else
+		{
+			// In an arena of its own, so removing it again on a later reload
+			// frees the whole subtree at once
+			auto *arena = new WidgetArena;
+			try
+			{
+				widget->adopt(widgetFromMarkup(after[i], arena));
+			}
+			catch (...)
+			{
+				delete arena;
+				throw;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < current.size(); i++)
+	{
+		if (kept[i])
+			continue;
+
+		current[i]->invalidate();
+		Widget::destroy(current[i]);
+	}
+
+	// Anything could have moved
+	widget->invalidate();
+	widget->invalidateLayout();
 }
 
-void Renderer::rect(Box at, Color color)
+void Application::setTag(Widget *widget, std::string_view tag)
 {
-	SDL_Rect rect = at.toSDLRect();
+	widget->tag = tag;
+}
 
-	SDL_SetRenderDrawColor(renderer, color.r, color.g, color.g, color.a);
-	SDL_RenderDrawRect(renderer, &rect);
+const Prototype &Application::registerPrototype(const std::string &name, pugi::xml_node doc)
+{
+	auto prototype = std::make_unique<Prototype>();
+	flatten(*prototype, doc);
+
+	auto &slot = prototypes[name];
+	slot = std::move(prototype);
+	return *slot;
 }
 
-Texture Renderer::loadImage(const char *path)
+void Application::flatten(Prototype &prototype, pugi::xml_node doc)
 {
-	SDL_Surface *surface = IMG_Load(path);
-	if (!surface)
-		throw std::runtime_error("Could not load image from path");
+	const WidgetRegistry::Entry *entry = WidgetRegistry::shared().lookup(doc.name());
+	if (!entry)
+	{
+		throw std::invalid_argument("Cannot find widget with name '" + std::string(doc.name()) + "'");
+	}
 
-	SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
-	if (!texture)
+	size_t index = prototype.nodes.size();
+	prototype.nodes.push_back({entry->construct, entry->name, 0, prototype.properties.size(), 0});
+
+	for (auto &attr : doc.attributes())
 	{
-		if (surface)
-			SDL_FreeSurface(surface);
+		// Parsed here, once for every instance
+		prototype.properties.emplace_back(attr.name(), Property(attr.value()));
+	}
+	prototype.nodes[index].propertyCount = prototype.properties.size() - prototype.nodes[index].firstProperty;
 
-		throw std::runtime_error("Could not convert surface to texture");
+	for (auto &child : doc.children())
+	{
+		if (child.type() == pugi::node_element)
+			flatten(prototype, child);
 	}
 
-	return Texture(texture);
+	prototype.nodes[index].end = prototype.nodes.size();
 }
 
-void Renderer::texture(const Texture &texture, Box at)
+const Prototype &Application::prototype(const std::string &name) const
 {
-	SDL_Rect dest = at.toSDLRect();
+	auto it = prototypes.find(name);
+	if (it == prototypes.end())
+	{
+		throw std::invalid_argument("Cannot find prototype with name '" + name + "'");
+	}
+	return *it->second;
+}
 
-	SDL_RenderCopy(renderer, texture.texture.get(), nullptr, &dest);
+Widget *Application::instantiate(const std::string &name, WidgetArena *arena) const
+{
+	return prototype(name).instantiate(arena);
 }
 
-void Window::update()
+Widget *Prototype::instantiate(WidgetArena *arena) const
 {
-	renderer->clear();
+	bool owned = !arena;
+	if (owned)
+		arena = new WidgetArena;
 
-	if (central)
+	try
+	{
+		// Widgets whose subtrees are still being filled, with where they end
+		std::vector<std::pair<Widget *, size_t>> open;
+		Widget *root = nullptr;
+
+		for (size_t i = 0; i < nodes.size(); i++)
+		{
+			const Node &node = nodes[i];
+			Widget *widget = node.construct(arena);
+			widget->tag = node.tag;
+
+			const auto *property = properties.data() + node.firstProperty;
+			for (size_t p = 0; p < node.propertyCount; p++, property++)
+				widget->share(property->first, property->second);
+
+			while (!open.empty() && i >= open.back().second)
+				open.pop_back();
+
+			if (open.empty())
+				root = widget;
+			else
+				open.back().first->addChild(widget);
+
+			open.emplace_back(widget, node.end);
+		}
+
+		return root;
+	}
+	catch (...)
 	{
-		central->render(Box(getSize()), *renderer);
+		if (owned)
+			delete arena;
+		throw;
 	}
+}
 
-	renderer->present();
+Widget *Application::fromQDF(const char *path)
+{
+	ng::qdf::QDFRoot document;
+	ng::qdf::QDFParseError error = ng::qdf::QDFParseError::NONE;
+	document.fromFile(error, path);
+	if (error != ng::qdf::QDFParseError::NONE || document.children.count() == 0)
+	{
+		throw std::invalid_argument("Could not load widget from path");
+	}
+
+	auto *arena = new WidgetArena;
+	try
+	{
+		return widgetFromQDF(document.children[0], arena);
+	}
+	catch (...)
+	{
+		delete arena;
+		throw;
+	}
 }
 
-Size Window::getSize()
+Widget *Application::widgetFromQDF(ng::qdf::QDF &node, WidgetArena *arena)
 {
-	Size size = {0};
-	SDL_GetRendererOutputSize(renderer->renderer, &size.w, &size.h);
-	return size;
+	auto *widget = widgetByName<Widget>(node.key, arena);
+	populateFromQDF(widget, node);
+	return widget;
 }
 
-void Widget::render(Box boundingBox, Renderer &renderer)
+void Application::populateFromQDF(Widget *widget, ng::qdf::QDF &node)
 {
-	renderer.rect(boundingBox, Color(255, 255, 255));
+	for (auto &child : node.children)
+	{
+		if (child.values.count() == 0)
+		{
+			widget->addChild(widgetFromQDF(child, widget->getArena()));
+		}
+		else if (child.values.count() == 1)
+		{
+			// Straight out of the document's string buffer
+			widget->set(std::string(child.key), child.values[0]);
+		}
+		else
+		{
+			// Lists are joined back up with spaces
+			std::string value;
+			for (auto &v : child.values)
+			{
+				if (!value.empty())
+					value += ' ';
+				value += v;
+			}
+			widget->set(std::string(child.key), std::move(value));
+		}
+	}
+}
+
+Window::Window(const char *name, RenderBackend backend, Size size)
+	: hitIndex(std::make_unique<SpatialGrid<Widget *>>())
+{
+	if (backend == RenderBackend::Software)
+	{
+		renderer = new SoftwareRenderer(size);
+		return;
+	}
 
+	window = SDL_CreateWindow(name, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, size.w, size.h,
+		SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
+	renderer = new Renderer(this);
+	updateRefreshRate();
+}
+
+void Window::updateRefreshRate()
+{
+	SDL_DisplayMode mode;
+	int display = SDL_GetWindowDisplayIndex(window);
+	if (display >= 0 && SDL_GetCurrentDisplayMode(display, &mode) == 0 && mode.refresh_rate > 0)
+		refreshRate = mode.refresh_rate;
+	else
+		refreshRate = 60;
+
+	frameInterval = SDL_GetPerformanceFrequency() / refreshRate;
+}
+
+void Window::setLayerBudget(size_t bytes)
+{
+	layerBudget = bytes;
+	while (layerUsed > layerBudget && !layers.empty())
+		layers.back()->dropLayer();
+}
+
+void Window::addLayer(Widget *widget)
+{
+	layers.push_front(widget);
+	widget->layerEntry = layers.begin();
+	layerUsed += widget->layer.bytes();
+
+	// Least recently drawn first, never the one that's just been made
+	while (layerUsed > layerBudget && layers.back() != widget)
+		layers.back()->dropLayer();
+}
+
+void Window::touchLayer(Widget *widget)
+{
+	layers.splice(layers.begin(), layers, widget->layerEntry);
+}
+
+void Window::removeLayer(Widget *widget)
+{
+	layerUsed -= widget->layer.bytes();
+	layers.erase(widget->layerEntry);
+}
+
+void Window::targetsLost(bool device)
+{
+	backbuffer = Texture();
+	while (!layers.empty())
+		layers.back()->dropLayer();
+
+	if (device)
+		renderer->texturesLost();
+	invalidate();
+}
+
+int Window::msUntilFrame(Uint64 now) const
+{
+	if (!dirty || minimized)
+		return -1;
+	if (now >= nextFrame)
+		return 0;
+
+	Uint64 frequency = SDL_GetPerformanceFrequency();
+	return static_cast<int>(((nextFrame - now) * 1000 + frequency - 1) / frequency);
+}
+
+Window::~Window()
+{
+	if (central)
+		Widget::destroy(central);
+	// Textures have to go before the renderer that owns them
+	backbuffer = Texture();
+	if (renderer)
+		delete renderer;
+	if (window)
+		SDL_DestroyWindow(window);
+}
+
+Renderer::Renderer(Window *win)
+{
+	window = win;
+	renderer = SDL_CreateRenderer(win->window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
+}
+
+Renderer::Renderer() = default;
+
+Renderer::~Renderer()
+{
+	// Pending batches and the caches hold textures that have to go first
+	batches.clear();
+	images.clear();
+	glyphs.reset();
+	if (renderer)
+		SDL_DestroyRenderer(renderer);
+}
+
+void Renderer::clear(Color color)
+{
+	// Anything still pending would be cleared away anyway
+	batches.clear();
+	commands.clear();
+
+	setDrawColor(color);
+	SDL_RenderClear(renderer);
+}
+
+void Renderer::present()
+{
+	flush();
+	NGUI_PROFILE_SCOPE("Renderer::present");
+	SDL_RenderPresent(renderer);
+	endFrame();
+}
+
+void Renderer::rect(Box at, Color color)
+{
+	at = translated(at);
+	if (batching)
+		return record(DrawKind::Outline, color, nullptr, at);
+
+	SDL_Rect rect = at.toSDLRect();
+
+	setDrawColor(color);
+	SDL_RenderDrawRect(renderer, &rect);
+}
+
+void Renderer::fill(Box at, Color color)
+{
+	at = translated(at);
+	if (batching)
+		return record(DrawKind::Fill, color, nullptr, at);
+
+	SDL_Rect rect = at.toSDLRect();
+
+	setDrawColor(color);
+	SDL_RenderFillRect(renderer, &rect);
+}
+
+void Renderer::line(Point a, Point b, Color color, int width)
+{
+	a = Point{a.x + offset.x, a.y + offset.y};
+	b = Point{b.x + offset.x, b.y + offset.y};
+	width = std::max(1, width);
+
+	int half = (width + 1) / 2;
+	Box bounds(std::min(a.x, b.x) - half, std::min(a.y, b.y) - half,
+		std::abs(b.x - a.x) + 2 * half + 1, std::abs(b.y - a.y) + 2 * half + 1);
+	SDL_Rect ends = {a.x, a.y, b.x, b.y};
+	if (batching)
+		return record(DrawKind::Line, color, nullptr, width, bounds, ends);
+
+	// A batch of one, so wide lines look the same either way
+	submit(DrawBatch{DrawKind::Line, color, nullptr, width, bounds, 1, 0}, &ends);
+}
+
+namespace
+{
+
+// Deepest a curve is split, i.e. at most 2^16 segments
+constexpr int maxCurveDepth = 16;
+// Furthest a flattened curve strays from the real one, in pixels
+constexpr float curveTolerance = 0.2f;
+// Curves not drawn for this many frames are dropped, checked as often
+constexpr unsigned long curveLifetime = 32;
+
+// Adds the end of every segment after the start, splitting wherever the
+// control points are further than tolerance from the chord
+void flatten(const Bezier &b, float tolerance, std::vector<SDL_FPoint> &out, int depth = 0)
+{
+	float dx = b.x3 - b.x0;
+	float dy = b.y3 - b.y0;
+	float chord = dx * dx + dy * dy;
+
+	bool flat;
+	if (chord > 1e-6f)
+	{
+		// Both distances times the chord length, so no square root
+		float d1 = std::abs((b.x1 - b.x3) * dy - (b.y1 - b.y3) * dx);
+		float d2 = std::abs((b.x2 - b.x3) * dy - (b.y2 - b.y3) * dx);
+		flat = (d1 + d2) * (d1 + d2) <= tolerance * tolerance * chord;
+	}
+	else
+	{
+		// Starts and ends in the same place, so only the control points tell
+		float d1 = std::abs(b.x1 - b.x0) + std::abs(b.y1 - b.y0);
+		float d2 = std::abs(b.x2 - b.x0) + std::abs(b.y2 - b.y0);
+		flat = std::max(d1, d2) <= tolerance;
+	}
+
+	if (flat || depth >= maxCurveDepth)
+	{
+		out.push_back(SDL_FPoint{b.x3, b.y3});
+		return;
+	}
+
+	// De Casteljau at t = 0.5
+	float x01 = (b.x0 + b.x1) / 2, y01 = (b.y0 + b.y1) / 2;
+	float x12 = (b.x1 + b.x2) / 2, y12 = (b.y1 + b.y2) / 2;
+	float x23 = (b.x2 + b.x3) / 2, y23 = (b.y2 + b.y3) / 2;
+	float xa = (x01 + x12) / 2, ya = (y01 + y12) / 2;
+	float xb = (x12 + x23) / 2, yb = (y12 + y23) / 2;
+	float xm = (xa + xb) / 2, ym = (ya + yb) / 2;
+
+	flatten(Bezier{b.x0, b.y0, x01, y01, xa, ya, xm, ym}, tolerance, out, depth + 1);
+	flatten(Bezier{xm, ym, xb, yb, x23, y23, b.x3, b.y3}, tolerance, out, depth + 1);
+}
+
+uint32_t floatBits(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+}
+
+void Renderer::curve(const Bezier &bezier, float width, Color color, float scale, SDL_FPoint origin)
+{
+	const CurveStrip &strip = tessellate(bezier, width, scale);
+
+	origin.x += offset.x;
+	origin.y += offset.y;
+	Box bounds(static_cast<int>(std::floor(origin.x + strip.left * scale)),
+		static_cast<int>(std::floor(origin.y + strip.top * scale)),
+		static_cast<int>(std::ceil((strip.right - strip.left) * scale)) + 2,
+		static_cast<int>(std::ceil((strip.bottom - strip.top) * scale)) + 2);
+
+	SDL_Rect command = {static_cast<int>(curveDraws.size()), 0, 0, 0};
+	curveDraws.push_back(CurveDraw{&strip, scale, origin});
+	if (batching)
+		return record(DrawKind::Curve, color, nullptr, 0, bounds, command);
+
+	submit(DrawBatch{DrawKind::Curve, color, nullptr, 0, bounds, 1, 0}, &command);
+	curveDraws.clear();
+}
+
+const Renderer::CurveStrip &Renderer::tessellate(const Bezier &bezier, float width, float scale)
+{
+	// Everything in one half octave of scale shares a tessellation, made fine
+	// enough for the bottom of it
+	int zoom = static_cast<int>(std::floor(std::log2(std::max(scale, 1e-6f)) * 2));
+	auto [it, added] = curves.try_emplace(CurveKey{bezier, width, zoom});
+	CurveStrip &strip = it->second;
+	strip.used = curveFrame;
+	if (!added)
+		return strip;
+
+	NGUI_PROFILE_COUNT(Tessellations, 1);
+	tessellations++;
+
+	std::vector<SDL_FPoint> middle = {SDL_FPoint{bezier.x0, bezier.y0}};
+	flatten(bezier, curveTolerance / std::exp2(zoom * 0.5f), middle);
+
+	// Each point pushed out both ways along the normal of the curve there
+	float half = width / 2;
+	size_t n = middle.size();
+	strip.points.resize(n * 2);
+	strip.left = strip.right = bezier.x0;
+	strip.top = strip.bottom = bezier.y0;
+	for (size_t i = 0; i < n; i++)
+	{
+		const SDL_FPoint &before = middle[i > 0 ? i - 1 : 0];
+		const SDL_FPoint &after = middle[i + 1 < n ? i + 1 : n - 1];
+		float tx = after.x - before.x;
+		float ty = after.y - before.y;
+		float length = std::sqrt(tx * tx + ty * ty);
+		float nx = length > 0 ? -ty / length * half : 0;
+		float ny = length > 0 ? tx / length * half : half;
+
+		SDL_FPoint left = {middle[i].x + nx, middle[i].y + ny};
+		SDL_FPoint right = {middle[i].x - nx, middle[i].y - ny};
+		strip.points[i * 2] = left;
+		strip.points[i * 2 + 1] = right;
+
+		strip.left = std::min({strip.left, left.x, right.x});
+		strip.right = std::max({strip.right, left.x, right.x});
+		strip.top = std::min({strip.top, left.y, right.y});
+		strip.bottom = std::max({strip.bottom, left.y, right.y});
+	}
+
+	return strip;
+}
+
+void Renderer::endFrame()
+{
+	curveFrame++;
+	if (curveFrame % curveLifetime != 0)
+		return;
+
+	for (auto it = curves.begin(); it != curves.end();)
+	{
+		if (it->second.used + curveLifetime < curveFrame)
+			it = curves.erase(it);
+		else
+			++it;
+	}
+}
+
+size_t Renderer::CurveKeyHash::operator()(const CurveKey &key) const
+{
+	const Bezier &b = key.bezier;
+	uint32_t hash = 2166136261u;
+	for (float value : {b.x0, b.y0, b.x1, b.y1, b.x2, b.y2, b.x3, b.y3, key.width})
+		hash = (hash ^ floatBits(value)) * 16777619u;
+	return (hash ^ static_cast<uint32_t>(key.zoom)) * 16777619u;
+}
+
+void Renderer::setClip(const Box *clip)
+{
+	flush();
+
+	clipping = clip != nullptr;
+	if (clipping)
+	{
+		clipBox = *clip;
+		SDL_Rect rect = clipBox.toSDLRect();
+		SDL_RenderSetClipRect(renderer, &rect);
+	}
+	else
+	{
+		SDL_RenderSetClipRect(renderer, nullptr);
+	}
+}
+
+namespace
+{
+
+// Makes texture blend as premultiplied alpha, if the backend can
+bool blendPremultiplied(SDL_Texture *texture)
+{
+#if SDL_VERSION_ATLEAST(2, 0, 6)
+	SDL_BlendMode premultiplied = SDL_ComposeCustomBlendMode(
+		SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD,
+		SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD);
+	return SDL_SetTextureBlendMode(texture, premultiplied) == 0;
+#else
+	(void)texture;
+	return false;
+#endif
+}
+
+}
+
+Texture Renderer::createTarget(Size size)
+{
+	SDL_Texture *target = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, size.w, size.h);
+	if (!target)
+		return Texture();
+
+	// Blending into a cleared target leaves colors already multiplied by
+	// alpha, so drawing it with plain blending would darken its edges. Where
+	// the backend can't do better that's still what happens.
+	blendPremultiplied(target);
+	return Texture(target);
+}
+
+void Renderer::setTarget(const Texture &target)
+{
+	flush();
+	activeTarget = target;
+	SDL_SetRenderTarget(renderer, target.texture.get());
+}
+
+void Renderer::resetTarget()
+{
+	flush();
+	activeTarget = Texture();
+	SDL_SetRenderTarget(renderer, nullptr);
+}
+
+void Renderer::pushClip(Box box)
+{
+	clipStack.emplace_back(clipping, clipBox);
+
+	Box narrowed = translated(box);
+	if (clipping)
+		narrowed = clipBox.intersected(narrowed);
+	setClip(&narrowed);
+}
+
+void Renderer::popClip()
+{
+	auto [wasClipping, previous] = clipStack.back();
+	clipStack.pop_back();
+	setClip(wasClipping ? &previous : nullptr);
+}
+
+void Renderer::beginLayer(const Texture &layer, Point origin)
+{
+	layerStack.push_back(LayerState{activeTarget, clipping, clipBox, offset});
+
+	setTarget(layer);
+	setClip(nullptr);
+	offset = Point{-origin.x, -origin.y};
+	clear(Color(0, 0, 0, 0));
+}
+
+void Renderer::endLayer()
+{
+	LayerState previous = std::move(layerStack.back());
+	layerStack.pop_back();
+
+	if (previous.target)
+		setTarget(previous.target);
+	else
+		resetTarget();
+
+	setClip(previous.clipping ? &previous.clipBox : nullptr);
+	offset = previous.offset;
+}
+
+Texture Renderer::loadImage(const char *path)
+{
+	if (Texture cached = images.find(path))
+		return cached;
+
+	NGUI_PROFILE_SCOPE("Renderer::loadImage");
+	SDL_Surface *surface = IMG_Load(path);
+	if (!surface)
+		throw std::runtime_error("Could not load image from path");
+
+	Texture texture;
+	try
+	{
+		texture = textureFromSurface(surface);
+	}
+	catch (...)
+	{
+		SDL_FreeSurface(surface);
+		throw;
+	}
+	SDL_FreeSurface(surface);
+
+	images.insert(path, texture);
+	return texture;
+}
+
+Texture Renderer::loadImage(const char *key, SDL_Surface *decoded)
+{
+	if (Texture cached = images.find(key))
+		return cached;
+
+	Texture texture = textureFromSurface(decoded);
+	images.insert(key, texture);
+	return texture;
+}
+
+Texture Renderer::textureFromSurface(SDL_Surface *surface)
+{
+	NGUI_PROFILE_SCOPE("texture upload");
+	NGUI_PROFILE_COUNT(TextureUploads, 1);
+
+	SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
+	if (!texture)
+		throw std::runtime_error("Could not convert surface to texture");
+
+	return Texture(texture);
+}
+
+Texture Renderer::textureFromPremultiplied(SDL_Surface *surface)
+{
+	Texture texture = textureFromSurface(surface);
+	if (blendPremultiplied(texture.texture.get()))
+		return texture;
+
+	// The backend can't blend premultiplied, so divide alpha back out of a copy
+	SDL_Surface *straight = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+	if (!straight)
+		throw std::runtime_error("Could not convert image to ARGB8888");
+
+	SDL_LockSurface(straight);
+	for (int y = 0; y < straight->h; y++)
+	{
+		auto *row = reinterpret_cast<uint32_t *>(static_cast<char *>(straight->pixels) + y * straight->pitch);
+		for (int x = 0; x < straight->w; x++)
+		{
+			uint32_t p = row[x];
+			uint32_t a = p >> 24;
+			if (a == 255 || a == 0)
+				continue;
+			auto divide = [a](uint32_t c)
+			{
+				return std::min<uint32_t>(255, (c * 255 + a / 2) / a);
+			};
+			row[x] = (a << 24) | (divide((p >> 16) & 0xff) << 16) | (divide((p >> 8) & 0xff) << 8) | divide(p & 0xff);
+		}
+	}
+	SDL_UnlockSurface(straight);
+
+	SDL_UpdateTexture(texture.texture.get(), nullptr, straight->pixels, straight->pitch);
+	SDL_FreeSurface(straight);
+	return texture;
+}
+
+void Renderer::texture(const Texture &texture, Box at)
+{
+	if (!texture.texture)
+		return;
+
+	at = translated(at);
+	if (batching)
+		return record(DrawKind::Copy, Color(255, 255, 255), texture.texture, at);
+
+	SDL_Rect dest = at.toSDLRect();
+
+	SDL_RenderCopy(renderer, texture.texture.get(), nullptr, &dest);
+}
+
+void Renderer::texture(const Texture &texture, Box source, Box at, Color tint)
+{
+	if (!texture.texture || source.empty())
+		return;
+
+	at = translated(at);
+	SDL_Rect command = {static_cast<int>(regionDraws.size()), 0, 0, 0};
+	regionDraws.push_back(RegionDraw{source.toSDLRect(), at.toSDLRect()});
+	if (batching)
+		return record(DrawKind::Region, tint, texture.texture, 0, at, command);
+
+	submit(DrawBatch{DrawKind::Region, tint, texture.texture, 0, at, 1, 0}, &command);
+	regionDraws.clear();
+}
+
+void Renderer::text(Font &font, const TextRun &run, Point at, Color color)
+{
+	if (!visible(Box(at, run.size)))
+		return;
+
+	if (!glyphs)
+		glyphs = std::make_unique<GlyphAtlas>();
+	glyphs->trim();
+
+	// Everything rasterized first, so a page with new glyphs is only uploaded once
+	for (const TextRun::Glyph &glyph : run.glyphs)
+		glyphs->find(font, glyph.codepoint);
+
+	for (const TextRun::Glyph &glyph : run.glyphs)
+	{
+		const GlyphAtlas::Glyph &placed = glyphs->find(font, glyph.codepoint);
+		if (placed.source.empty())
+			continue;
+
+		Box dest(at.x + glyph.x + placed.offset.x, at.y + glyph.y + placed.offset.y, placed.source.w, placed.source.h);
+		texture(glyphs->page(*this, placed.page), placed.source, dest, color);
+	}
+}
+
+void Renderer::setBatching(bool enabled)
+{
+	if (!enabled)
+		flush();
+	batching = enabled;
+}
+
+void Renderer::setDrawColor(Color color)
+{
+	if (drawColorSet && color == drawColor)
+		return;
+
+	SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+	drawColor = color;
+	drawColorSet = true;
+}
+
+void Renderer::record(DrawKind kind, Color color, const std::shared_ptr<SDL_Texture> &texture, Box at)
+{
+	record(kind, color, texture, 0, at, at.toSDLRect());
+}
+
+void Renderer::record(DrawKind kind, Color color, const std::shared_ptr<SDL_Texture> &texture, int width, Box at,
+	const SDL_Rect &command)
+{
+	// Already translated
+	if (at.empty() || (clipping && !clipBox.intersects(at)))
+		return;
+
+	// How many batches back a command may be hoisted. Anything further costs
+	// more to search than the extra SDL call does.
+	constexpr size_t lookback = 16;
+
+	// A command can join an earlier batch with the same state as long as it
+	// doesn't overlap anything drawn after that batch, since then the draw
+	// order between them can't be observed
+	size_t target = batches.size();
+	for (size_t i = batches.size(); i-- > 0 && batches.size() - i <= lookback;)
+	{
+		const auto &batch = batches[i];
+		if (batch.kind == kind && batch.color == color && batch.texture == texture && batch.width == width)
+		{
+			target = i;
+			break;
+		}
+
+		if (batch.bounds.intersects(at))
+			break;
+	}
+
+	if (target == batches.size())
+		batches.push_back(DrawBatch{kind, color, texture, width, at, 0, 0});
+	else
+		batches[target].bounds = batches[target].bounds.united(at);
+
+	batches[target].count++;
+	commands.push_back(DrawCommand{static_cast<unsigned>(target), command});
+}
+
+void Renderer::flush()
+{
+	if (commands.empty())
+		return;
+
+	NGUI_PROFILE_SCOPE("Renderer::flush");
+
+	// Counting sort so every batch's rects end up contiguous, in recorded order
+	unsigned offset = 0;
+	for (auto &batch : batches)
+	{
+		batch.first = offset;
+		offset += batch.count;
+		batch.count = 0;
+	}
+
+	sortedRects.resize(commands.size());
+	for (const auto &command : commands)
+	{
+		auto &batch = batches[command.batch];
+		sortedRects[batch.first + batch.count++] = command.rect;
+	}
+
+	for (const auto &batch : batches)
+		submit(batch, sortedRects.data() + batch.first);
+
+	batches.clear();
+	commands.clear();
+	curveDraws.clear();
+	regionDraws.clear();
+}
+
+void Renderer::submit(const DrawBatch &batch, const SDL_Rect *rects)
+{
+	int count = static_cast<int>(batch.count);
+
+	switch (batch.kind)
+	{
+	case DrawKind::Outline:
+		setDrawColor(batch.color);
+		SDL_RenderDrawRects(renderer, rects, count);
+		NGUI_PROFILE_COUNT(DrawCalls, 1);
+		break;
+
+	case DrawKind::Fill:
+		setDrawColor(batch.color);
+		SDL_RenderFillRects(renderer, rects, count);
+		NGUI_PROFILE_COUNT(DrawCalls, 1);
+		break;
+
+	case DrawKind::Copy:
+		NGUI_PROFILE_COUNT(TextureBinds, 1);
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+		if (count > 1)
+		{
+			vertices.clear();
+			for (int i = 0; i < count; i++)
+			{
+				const SDL_Rect &r = rects[i];
+				float left = static_cast<float>(r.x);
+				float top = static_cast<float>(r.y);
+				float right = static_cast<float>(r.x + r.w);
+				float bottom = static_cast<float>(r.y + r.h);
+				SDL_Color white = {255, 255, 255, 255};
+
+				vertices.push_back(SDL_Vertex{{left, top}, white, {0, 0}});
+				vertices.push_back(SDL_Vertex{{right, top}, white, {1, 0}});
+				vertices.push_back(SDL_Vertex{{left, bottom}, white, {0, 1}});
+				vertices.push_back(SDL_Vertex{{right, bottom}, white, {1, 1}});
+			}
+
+			quadIndices(count);
+			SDL_RenderGeometry(renderer, batch.texture.get(), vertices.data(), count * 4, indices.data(), count * 6);
+			NGUI_PROFILE_COUNT(DrawCalls, 1);
+			break;
+		}
+#endif
+		for (int i = 0; i < count; i++)
+			SDL_RenderCopy(renderer, batch.texture.get(), nullptr, &rects[i]);
+		NGUI_PROFILE_COUNT(DrawCalls, count);
+		break;
+
+	case DrawKind::Line:
+	{
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+		// Each line as a quad along it, so they're all one call whatever the width
+		vertices.clear();
+		SDL_Color color = {batch.color.r, batch.color.g, batch.color.b, batch.color.a};
+		float half = batch.width * 0.5f;
+		for (int i = 0; i < count; i++)
+		{
+			const SDL_Rect &r = rects[i];
+			float x1 = r.x + 0.5f;
+			float y1 = r.y + 0.5f;
+			float x2 = r.w + 0.5f;
+			float y2 = r.h + 0.5f;
+			float length = std::sqrt((x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1));
+			float nx = length > 0 ? -(y2 - y1) / length * half : 0;
+			float ny = length > 0 ? (x2 - x1) / length * half : half;
+
+			vertices.push_back(SDL_Vertex{{x1 + nx, y1 + ny}, color, {0, 0}});
+			vertices.push_back(SDL_Vertex{{x2 + nx, y2 + ny}, color, {0, 0}});
+			vertices.push_back(SDL_Vertex{{x1 - nx, y1 - ny}, color, {0, 0}});
+			vertices.push_back(SDL_Vertex{{x2 - nx, y2 - ny}, color, {0, 0}});
+		}
+
+		quadIndices(count);
+		SDL_RenderGeometry(renderer, nullptr, vertices.data(), count * 4, indices.data(), count * 6);
+		NGUI_PROFILE_COUNT(DrawCalls, 1);
+#else
+		setDrawColor(batch.color);
+		for (int i = 0; i < count; i++)
+			SDL_RenderDrawLine(renderer, rects[i].x, rects[i].y, rects[i].w, rects[i].h);
+		NGUI_PROFILE_COUNT(DrawCalls, count);
+#endif
+		break;
+	}
+
+	case DrawKind::Curve:
+	{
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+		// Every curve's strip, moved into place, in a single call
+		vertices.clear();
+		curveIndices.clear();
+		SDL_Color color = {batch.color.r, batch.color.g, batch.color.b, batch.color.a};
+		for (int i = 0; i < count; i++)
+		{
+			const CurveDraw &draw = curveDraws[rects[i].x];
+			int base = static_cast<int>(vertices.size());
+			for (const SDL_FPoint &p : draw.strip->points)
+			{
+				SDL_FPoint at = {draw.origin.x + p.x * draw.scale, draw.origin.y + p.y * draw.scale};
+				vertices.push_back(SDL_Vertex{at, color, {0, 0}});
+			}
+
+			int quads = static_cast<int>(draw.strip->points.size() / 2) - 1;
+			for (int quad = 0; quad < quads; quad++)
+			{
+				for (int index : {0, 1, 2, 2, 1, 3})
+					curveIndices.push_back(base + quad * 2 + index);
+			}
+		}
+
+		SDL_RenderGeometry(renderer, nullptr, vertices.data(), static_cast<int>(vertices.size()),
+			curveIndices.data(), static_cast<int>(curveIndices.size()));
+		NGUI_PROFILE_COUNT(DrawCalls, 1);
+#else
+		// Hairlines along the middle of each strip
+		setDrawColor(batch.color);
+		for (int i = 0; i < count; i++)
+		{
+			const CurveDraw &draw = curveDraws[rects[i].x];
+			const std::vector<SDL_FPoint> &points = draw.strip->points;
+			for (size_t j = 0; j < points.size(); j += 2)
+			{
+				float x = draw.origin.x + (points[j].x + points[j + 1].x) / 2 * draw.scale;
+				float y = draw.origin.y + (points[j].y + points[j + 1].y) / 2 * draw.scale;
+				linePoints.push_back(SDL_Point{static_cast<int>(x), static_cast<int>(y)});
+			}
+			SDL_RenderDrawLines(renderer, linePoints.data(), static_cast<int>(linePoints.size()));
+			linePoints.clear();
+		}
+		NGUI_PROFILE_COUNT(DrawCalls, count);
+#endif
+		break;
+	}
+
+	case DrawKind::Region:
+	{
+		NGUI_PROFILE_COUNT(TextureBinds, 1);
+		SDL_Texture *texture = batch.texture.get();
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+		int w = 0;
+		int h = 0;
+		SDL_QueryTexture(texture, nullptr, nullptr, &w, &h);
+		if (w <= 0 || h <= 0)
+			break;
+
+		// Tinted through the vertex colors, so a whole batch is still one call
+		vertices.clear();
+		SDL_Color tint = {batch.color.r, batch.color.g, batch.color.b, batch.color.a};
+		for (int i = 0; i < count; i++)
+		{
+			const RegionDraw &draw = regionDraws[rects[i].x];
+			float left = static_cast<float>(draw.dest.x);
+			float top = static_cast<float>(draw.dest.y);
+			float right = static_cast<float>(draw.dest.x + draw.dest.w);
+			float bottom = static_cast<float>(draw.dest.y + draw.dest.h);
+			float u0 = static_cast<float>(draw.source.x) / w;
+			float v0 = static_cast<float>(draw.source.y) / h;
+			float u1 = static_cast<float>(draw.source.x + draw.source.w) / w;
+			float v1 = static_cast<float>(draw.source.y + draw.source.h) / h;
+
+			vertices.push_back(SDL_Vertex{{left, top}, tint, {u0, v0}});
+			vertices.push_back(SDL_Vertex{{right, top}, tint, {u1, v0}});
+			vertices.push_back(SDL_Vertex{{left, bottom}, tint, {u0, v1}});
+			vertices.push_back(SDL_Vertex{{right, bottom}, tint, {u1, v1}});
+		}
+
+		quadIndices(count);
+		SDL_RenderGeometry(renderer, texture, vertices.data(), count * 4, indices.data(), count * 6);
+		NGUI_PROFILE_COUNT(DrawCalls, 1);
+#else
+		SDL_SetTextureColorMod(texture, batch.color.r, batch.color.g, batch.color.b);
+		SDL_SetTextureAlphaMod(texture, batch.color.a);
+		for (int i = 0; i < count; i++)
+		{
+			const RegionDraw &draw = regionDraws[rects[i].x];
+			SDL_RenderCopy(renderer, texture, &draw.source, &draw.dest);
+		}
+		SDL_SetTextureColorMod(texture, 255, 255, 255);
+		SDL_SetTextureAlphaMod(texture, 255);
+		NGUI_PROFILE_COUNT(DrawCalls, count);
+#endif
+		break;
+	}
+	}
+}
+
+void Renderer::quadIndices(int count)
+{
+	// Every quad uses the same pattern, so the index buffer only ever grows
+	for (int quad = static_cast<int>(indices.size() / 6); quad < count; quad++)
+	{
+		int base = quad * 4;
+		for (int index : {0, 1, 2, 2, 1, 3})
+			indices.push_back(base + index);
+	}
+}
+
+void Window::handleEvent(const SDL_Event &event)
+{
+	switch (event.type)
+	{
+	case SDL_MOUSEMOTION:
+	case SDL_MOUSEBUTTONDOWN:
+	case SDL_MOUSEBUTTONUP:
+	case SDL_MOUSEWHEEL:
+		handleMouse(event);
+		return;
+
+	case SDL_KEYDOWN:
+	case SDL_KEYUP:
+	case SDL_TEXTINPUT:
+		handleKey(event);
+		return;
+
+	default:
+		break;
+	}
+
+	switch (event.window.event)
+	{
+	case SDL_WINDOWEVENT_EXPOSED:
+	case SDL_WINDOWEVENT_SIZE_CHANGED:
+		invalidate();
+		break;
+
+	case SDL_WINDOWEVENT_MINIMIZED:
+		minimized = true;
+		break;
+
+	case SDL_WINDOWEVENT_RESTORED:
+		minimized = false;
+		invalidate();
+		break;
+
+	// Possibly onto a display with a different refresh rate
+	case SDL_WINDOWEVENT_MOVED:
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+	case SDL_WINDOWEVENT_DISPLAY_CHANGED:
+#endif
+		updateRefreshRate();
+		break;
+
+	case SDL_WINDOWEVENT_LEAVE:
+		if (!captured)
+			hover(nullptr);
+		break;
+
+	default:
+		break;
+	}
+}
+
+void Window::handleMouse(const SDL_Event &event)
+{
+	MouseEvent mouseEvent = {};
+	mouseEvent.modifiers = SDL_GetModState();
+
+	switch (event.type)
+	{
+	case SDL_MOUSEMOTION:
+	{
+		mouse = toPixels(event.motion.x, event.motion.y);
+		mouseEvent.type = MouseEvent::Type::Move;
+		mouseEvent.position = mouse;
+
+		// While a button is held the pressed widget keeps the pointer
+		if (!captured)
+			hover(widgetAt(mouse));
+		dispatch(captured ? captured : hovered, mouseEvent);
+		break;
+	}
+
+	case SDL_MOUSEBUTTONDOWN:
+	{
+		mouse = toPixels(event.button.x, event.button.y);
+		mouseEvent.type = MouseEvent::Type::Press;
+		mouseEvent.position = mouse;
+		mouseEvent.button = event.button.button;
+		mouseEvent.clicks = event.button.clicks;
+
+		Widget *target = widgetAt(mouse);
+		hover(target);
+
+		Widget *focusable = target;
+		while (focusable && !focusable->get<bool>("focusable"))
+			focusable = focusable->parent;
+		setFocus(focusable);
+
+		captured = dispatch(target, mouseEvent);
+		break;
+	}
+
+	case SDL_MOUSEBUTTONUP:
+	{
+		mouse = toPixels(event.button.x, event.button.y);
+		mouseEvent.type = MouseEvent::Type::Release;
+		mouseEvent.position = mouse;
+		mouseEvent.button = event.button.button;
+		mouseEvent.clicks = event.button.clicks;
+
+		Widget *target = captured ? captured : widgetAt(mouse);
+		captured = nullptr;
+		dispatch(target, mouseEvent);
+		hover(widgetAt(mouse));
+		break;
+	}
+
+	case SDL_MOUSEWHEEL:
+	{
+		int direction = event.wheel.direction == SDL_MOUSEWHEEL_FLIPPED ? -1 : 1;
+		mouseEvent.type = MouseEvent::Type::Wheel;
+		mouseEvent.position = mouse;
+		mouseEvent.wheelX = event.wheel.x * direction;
+		mouseEvent.wheelY = event.wheel.y * direction;
+		dispatch(captured ? captured : widgetAt(mouse), mouseEvent);
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
+Point Window::toPixels(int x, int y) const
+{
+	if (!window)
+		return Point{x, y};
+
+	// Layout and the hit index are in output pixels
+	int width = 0, height = 0;
+	SDL_GetWindowSize(window, &width, &height);
+	Size output = renderer->outputSize();
+	if (width <= 0 || height <= 0 || (output.w == width && output.h == height))
+		return Point{x, y};
+
+	return Point{
+		static_cast<int>(static_cast<long long>(x) * output.w / width),
+		static_cast<int>(static_cast<long long>(y) * output.h / height)};
+}
+
+void Window::handleKey(const SDL_Event &event)
+{
+	KeyEvent keyEvent;
+	if (event.type == SDL_TEXTINPUT)
+	{
+		keyEvent.type = KeyEvent::Type::Text;
+		keyEvent.text = event.text.text;
+		keyEvent.modifiers = SDL_GetModState();
+	}
+	else
+	{
+		keyEvent.type = event.type == SDL_KEYDOWN ? KeyEvent::Type::Press : KeyEvent::Type::Release;
+		keyEvent.key = event.key.keysym.sym;
+		keyEvent.modifiers = event.key.keysym.mod;
+		keyEvent.repeat = event.key.repeat != 0;
+	}
+
+	dispatch(focused ? focused : central, keyEvent);
+}
+
+Widget *Window::dispatch(Widget *target, MouseEvent event)
+{
+	for (Widget *w = target; w; w = w->parent)
+	{
+		event.local = Point{event.position.x - w->lastBox.x, event.position.y - w->lastBox.y};
+		if (w->mouseEvent(event))
+			return w;
+
+		if (event.type == MouseEvent::Type::Enter || event.type == MouseEvent::Type::Leave)
+			break;
+	}
+	return nullptr;
+}
+
+Widget *Window::dispatch(Widget *target, const KeyEvent &event)
+{
+	for (Widget *w = target; w; w = w->parent)
+	{
+		if (w->keyEvent(event))
+			return w;
+	}
+	return nullptr;
+}
+
+void Window::hover(Widget *widget)
+{
+	if (widget == hovered)
+		return;
+
+	MouseEvent crossing = {};
+	crossing.position = mouse;
+	crossing.modifiers = SDL_GetModState();
+
+	if (hovered)
+	{
+		crossing.type = MouseEvent::Type::Leave;
+		dispatch(hovered, crossing);
+	}
+
+	hovered = widget;
+	if (hovered)
+	{
+		crossing.type = MouseEvent::Type::Enter;
+		dispatch(hovered, crossing);
+	}
+}
+
+Widget *Window::widgetAt(Point point) const
+{
+	Widget *top = nullptr;
+	hitIndex->query(point, [&top, point](Widget *widget, const Box &)
+	{
+		if (top && !widget->isAbove(top))
+			return;
+
+		// Not where it's been cut off by a clipping ancestor
+		for (Widget *p = widget->parent; p; p = p->parent)
+		{
+			if (p->clip && !p->lastBox.contains(point))
+				return;
+		}
+		top = widget;
+	});
+	return top;
+}
+
+void Window::setFocus(Widget *widget)
+{
+	focused = widget;
+}
+
+void Window::reindex(Widget *widget, Box box)
+{
+	if (widget->indexed)
+		hitIndex->move(widget, widget->lastBox, box);
+	else
+		hitIndex->insert(widget, box);
+	widget->indexed = true;
+}
+
+void Window::forget(Widget *widget)
+{
+	if (widget->indexed)
+		hitIndex->remove(widget, widget->lastBox);
+	widget->indexed = false;
+
+	if (hovered == widget)
+		hovered = nullptr;
+	if (captured == widget)
+		captured = nullptr;
+	if (focused == widget)
+		focused = nullptr;
+}
+
+void Window::setCentralWidget(Widget *widget)
+{
+	central = widget;
+	if (central)
+		central->attach(this);
+	invalidate();
+}
+
+void Window::damage(Box box)
+{
+	if (box.empty())
+		return;
+
+	dirty = true;
+	if (fullDamage)
+		return;
+
+	// Fold anything the new box touches into it so the list stays disjoint
+	for (size_t i = 0; i < damaged.size();)
+	{
+		if (damaged[i].intersects(box))
+		{
+			box = box.united(damaged[i]);
+			damaged[i] = damaged.back();
+			damaged.pop_back();
+			i = 0;
+		}
+		else
+		{
+			i++;
+		}
+	}
+	damaged.push_back(box);
+
+	// Past a handful of rects the repeated tree walks cost more than they save
+	if (damaged.size() > 8)
+	{
+		Box all;
+		for (const auto &b : damaged)
+			all = all.united(b);
+		damaged.clear();
+		damaged.push_back(all);
+	}
+}
+
+void Window::update()
+{
+#ifdef NGUI_PROFILER
+	uint64_t frameStart = Profiler::now();
+#endif
+	NGUI_PROFILE_SCOPE("Window::update");
+
+	PropertyBatch::flush();
+
+	Size size = getSize();
+	Box whole(size);
+
+	if (!backbuffer || size.w != backbufferSize.w || size.h != backbufferSize.h)
+	{
+		backbuffer = renderer->createTarget(size);
+		backbufferSize = size;
+		fullDamage = true;
+	}
+
+	// Layout before drawing, since it adds to the damage
+	if (central && (central->layoutDirty || size != layoutSize))
+	{
+		NGUI_PROFILE_SCOPE("layout");
+		central->arrange(whole);
+		layoutSize = size;
+	}
+
+	// Anything invalidated from here on is for the next frame
+	dirty = false;
+
+	// Without a render target there's nothing to keep between frames
+	if (fullDamage || !backbuffer)
+	{
+		damaged.clear();
+		damaged.push_back(whole);
+	}
+
+	if (backbuffer)
+		renderer->setTarget(backbuffer);
+
+	for (const auto &box : damaged)
+	{
+		Box clip = box.intersected(whole);
+		if (clip.empty())
+			continue;
+
+		renderer->setClip(&clip);
+		renderer->fill(clip, background);
+
+		if (central)
+			central->paint(central->layoutBox, *renderer);
+	}
+	renderer->setClip(nullptr);
+
+	damaged.clear();
+	fullDamage = false;
+
+	if (backbuffer)
+	{
+		renderer->resetTarget();
+		renderer->texture(backbuffer, whole);
+	}
+
+#ifdef NGUI_PROFILER
+	// On the screen rather than the backbuffer, so it never needs damage
+	if (profilerOverlay)
+		Profiler::shared().drawOverlay(*renderer, whole);
+#endif
+
+	renderer->present();
+
+	// Keep to the display's cadence, or start a new one after being idle or late
+	if (frameInterval)
+	{
+		Uint64 now = SDL_GetPerformanceCounter();
+		nextFrame = nextFrame + frameInterval > now ? nextFrame + frameInterval : now + frameInterval;
+	}
+
+#ifdef NGUI_PROFILER
+	Profiler::shared().frame(frameStart, Profiler::now());
+#endif
+}
+
+Size Texture::getSize() const
+{
+	Size size = {0, 0};
+	if (texture)
+		SDL_QueryTexture(texture.get(), nullptr, nullptr, &size.w, &size.h);
+	else if (pixmap)
+		size = Size{pixmap->w, pixmap->h};
+	return size;
+}
+
+Texture TextureCache::find(const std::string &key)
+{
+	auto it = entries.find(key);
+	if (it == entries.end())
+	{
+		missCount++;
+		return Texture();
+	}
+
+	hitCount++;
+	recent.splice(recent.begin(), recent, it->second.recent);
+	return it->second.texture;
+}
+
+void TextureCache::insert(const std::string &key, const Texture &texture)
+{
+	auto it = entries.find(key);
+	if (it != entries.end())
+	{
+		used -= it->second.bytes;
+		recent.erase(it->second.recent);
+		entries.erase(it);
+	}
+
+	recent.push_front(key);
+	size_t bytes = texture.bytes();
+	entries.emplace(key, Entry{texture, bytes, recent.begin()});
+	used += bytes;
+
+	trim();
+}
+
+void Renderer::texturesLost()
+{
+	images.clear();
+	glyphs.reset();
+	generation++;
+}
+
+void TextureCache::clear()
+{
+	entries.clear();
+	recent.clear();
+	used = 0;
+}
+
+void TextureCache::trim()
+{
+	// Textures still in use stay, since evicting them wouldn't free anything
+	for (auto it = recent.end(); used > budget && it != recent.begin();)
+	{
+		--it;
+		auto entry = entries.find(*it);
+		if (entry->second.texture.shared())
+			continue;
+
+		used -= entry->second.bytes;
+		entries.erase(entry);
+		it = recent.erase(it);
+		evictionCount++;
+	}
+}
+
+Size Window::getSize()
+{
+	return renderer->outputSize();
+}
+
+Size Renderer::outputSize()
+{
+	Size size = {0, 0};
+	SDL_GetRendererOutputSize(renderer, &size.w, &size.h);
+	return size;
+}
+
+void Property::assign(std::string source)
+{
+	text = std::make_shared<const std::string>(std::move(source));
+	const std::string &value = *text;
+	textStale = false;
+	valueType = Type::String;
+	integer = 0;
+	real = 0;
+	color = Color(0, 0, 0, 0);
+	flag = !value.empty() && value != "false";
+
+	if (value.empty())
+		return;
+
+	const char *begin = value.c_str();
+	const char *end = begin + value.size();
+	char *parsed = nullptr;
+
+	if (value == "true" || value == "false")
+	{
+		valueType = Type::Bool;
+		integer = flag;
+		real = flag;
+		return;
+	}
+
+	// #rgb, #rgba, #rrggbb or #rrggbbaa
+	if (value[0] == '#')
+	{
+		size_t digits = value.size() - 1;
+		bool hex = value.find_first_not_of("0123456789abcdefABCDEF", 1) == std::string::npos;
+		if (!hex || (digits != 3 && digits != 4 && digits != 6 && digits != 8))
+		{
+			std::cerr << "'" << value << "' is not a color, expected #rgb, #rgba, #rrggbb or #rrggbbaa" << std::endl;
+			return;
+		}
+
+		unsigned long rgba = std::strtoul(begin + 1, nullptr, 16);
+		if (digits <= 4)
+		{
+			// Each digit doubled, #f80 is #ff8800
+			unsigned long wide = 0;
+			for (size_t n = 0; n < digits; n++)
+				wide = (wide << 8) | ((rgba >> (4 * (digits - 1 - n))) & 0xf) * 0x11;
+			rgba = wide;
+		}
+		if (digits == 3 || digits == 6)
+			rgba = (rgba << 8) | 0xff;
+
+		color = Color(rgba >> 24, (rgba >> 16) & 0xff, (rgba >> 8) & 0xff, rgba & 0xff);
+		valueType = Type::Color;
+		flag = color.a > 0;
+		return;
+	}
+
+	long i = std::strtol(begin, &parsed, 10);
+	if (parsed == end && i >= INT_MIN && i <= INT_MAX)
+	{
+		valueType = Type::Int;
+		integer = static_cast<int>(i);
+		real = static_cast<float>(i);
+		flag = i != 0;
+		return;
+	}
+
+	// Including integers too big for an int
+	float f = std::strtof(begin, &parsed);
+	if (parsed == end)
+	{
+		valueType = Type::Float;
+		integer = saturate(f);
+		real = f;
+		flag = f != 0;
+	}
+}
+
+void Property::share(const Property &other)
+{
+	// Numbers are stale in the prototype until read once; do it there
+	other.toString();
+
+	text = other.text;
+	textStale = false;
+	valueType = other.valueType;
+	flag = other.flag;
+	integer = other.integer;
+	real = other.real;
+	color = other.color;
+	changed();
+}
+
+const std::string &Property::toString() const
+{
+	static const std::string empty;
+
+	if (!textStale)
+		return text ? *text : empty;
+
+	std::string value;
+
+	switch (valueType)
+	{
+	case Type::Bool:
+		value = flag ? "true" : "false";
+		break;
+
+	case Type::Int:
+		value = std::to_string(integer);
+		break;
+
+	case Type::Float:
+		value = std::to_string(real);
+		break;
+
+	case Type::Color:
+	{
+		char hex[10];
+		std::snprintf(hex, sizeof(hex), "#%02x%02x%02x%02x", color.r, color.g, color.b, color.a);
+		value = hex;
+		break;
+	}
+
+	case Type::String:
+		break;
+	}
+
+	text = std::make_shared<const std::string>(std::move(value));
+	textStale = false;
+	return *text;
+}
+
+int Property::index(std::initializer_list<const char *> options, int fallback) const
+{
+	const std::string &value = toString();
+
+	int i = 0;
+	for (const char *option : options)
+	{
+		if (value == option)
+			return i;
+		i++;
+	}
+	return fallback;
+}
+
+struct Property::Binding
+{
+	Property *target = nullptr;
+	std::vector<const Property *> sources;
+	std::function<void (const std::vector<const Property *> &)> update;
+	// Longer than any chain of bindings feeding into this one, which is the order they run in
+	unsigned rank = 1;
+	bool scheduled = false;
+};
+
+struct Property::Links
+{
+	// The binding that sets this property
+	std::unique_ptr<Binding> binding;
+	// Bindings that read it
+	std::vector<Binding *> dependents;
+};
+
+namespace
+{
+
+int batchDepth = 0;
+bool flushing = false;
+std::vector<Property *> pendingChanges;
+
+// Listeners that keep setting each other's properties get cut off after this many passes
+constexpr int maxFlushRounds = 100;
+
+}
+
+Property::Property() = default;
+
+Property::Property(std::string value)
+{
+	assign(std::move(value));
+}
+
+Property::Property(Property &&other) noexcept = default;
+Property &Property::operator=(Property &&other) noexcept = default;
+
+Property::~Property()
+{
+	if (queued)
+		std::replace(pendingChanges.begin(), pendingChanges.end(), this, static_cast<Property *>(nullptr));
+
+	if (links)
+	{
+		unbind();
+
+		// Whatever was computed from this can't be any more
+		while (!links->dependents.empty())
+			links->dependents.back()->target->unbind();
+	}
+}
+
+void Property::changed()
+{
+	// Nothing reads this, so there's nothing to order. Whatever the listeners
+	// set is still queued until they return rather than recursing.
+	if (batchDepth == 0 && !links)
+	{
+		batchDepth++;
+		notify();
+		batchDepth--;
+		PropertyBatch::flush();
+		return;
+	}
+
+	if (!queued)
+	{
+		queued = true;
+		pendingChanges.push_back(this);
+	}
+
+	if (batchDepth == 0)
+		PropertyBatch::flush();
+}
+
+void Property::notify()
+{
+	if (!listeners.empty())
+	{
+		const std::string &value = toString();
+		for (const auto &f : listeners)
+		{
+			f(value);
+		}
+	}
+
+	if (owner)
+		owner->invalidate();
+}
+
+Property::Links &Property::linked() const
+{
+	if (!links)
+		links = std::make_unique<Links>();
+	return *links;
+}
+
+void Property::bind(std::unique_ptr<Binding> binding)
+{
+	// Everything upstream of the sources, which can't include this
+	std::unordered_set<const Property *> seen;
+	std::vector<const Property *> upstream = binding->sources;
+	while (!upstream.empty())
+	{
+		const Property *prop = upstream.back();
+		upstream.pop_back();
+		if (prop == this)
+			throw std::invalid_argument("Binding would make a property depend on itself");
+
+		if (seen.insert(prop).second && prop->links && prop->links->binding)
+		{
+			const auto &sources = prop->links->binding->sources;
+			upstream.insert(upstream.end(), sources.begin(), sources.end());
+		}
+	}
+
+	unbind();
+
+	for (const Property *source : binding->sources)
+	{
+		Links &sourceLinks = source->linked();
+		sourceLinks.dependents.push_back(binding.get());
+		if (sourceLinks.binding)
+			binding->rank = std::max(binding->rank, sourceLinks.binding->rank + 1);
+	}
+
+	Binding *added = binding.get();
+	added->target = this;
+	linked().binding = std::move(binding);
+	raiseDependents();
+
+	added->update(added->sources);
+}
+
+void Property::unbind()
+{
+	if (!links || !links->binding)
+		return;
+
+	Binding *binding = links->binding.get();
+	for (const Property *source : binding->sources)
+	{
+		auto &dependents = source->links->dependents;
+		dependents.erase(std::find(dependents.begin(), dependents.end(), binding));
+	}
+	links->binding.reset();
+}
+
+void Property::raiseDependents()
+{
+	unsigned rank = links && links->binding ? links->binding->rank : 0;
+	for (Binding *dependent : links->dependents)
+	{
+		if (dependent->rank <= rank)
+		{
+			dependent->rank = rank + 1;
+			dependent->target->raiseDependents();
+		}
+	}
+}
+
+PropertyBatch::PropertyBatch()
+{
+	batchDepth++;
+}
+
+PropertyBatch::~PropertyBatch()
+{
+	batchDepth--;
+}
+
+void PropertyBatch::flush()
+{
+	// Anything set from inside is picked up by the running flush
+	if (flushing || pendingChanges.empty())
+		return;
+
+	NGUI_PROFILE_SCOPE("properties");
+	flushing = true;
+	batchDepth++;
+
+	auto later = [](const Property::Binding *a, const Property::Binding *b)
+	{
+		return a->rank > b->rank;
+	};
+
+	std::vector<Property::Binding *> ready;
+	size_t scanned = 0;
+	size_t notified = 0;
+	int rounds = 0;
+
+	while (notified < pendingChanges.size())
+	{
+		if (++rounds > maxFlushRounds)
+		{
+			std::cerr << "Property listeners still changing each other after " << maxFlushRounds
+				<< " rounds, dropping the rest" << std::endl;
+			for (; notified < pendingChanges.size(); notified++)
+			{
+				if (Property *prop = pendingChanges[notified])
+					prop->queued = false;
+			}
+			break;
+		}
+
+		// Bindings first, lowest rank first, so each runs once after everything it reads
+		while (true)
+		{
+			for (; scanned < pendingChanges.size(); scanned++)
+			{
+				Property *prop = pendingChanges[scanned];
+				if (!prop || !prop->links)
+					continue;
+
+				for (Property::Binding *dependent : prop->links->dependents)
+				{
+					if (dependent->scheduled)
+						continue;
+					dependent->scheduled = true;
+					ready.push_back(dependent);
+					std::push_heap(ready.begin(), ready.end(), later);
+				}
+			}
+
+			if (ready.empty())
+				break;
+
+			std::pop_heap(ready.begin(), ready.end(), later);
+			Property::Binding *binding = ready.back();
+			ready.pop_back();
+			binding->scheduled = false;
+			binding->update(binding->sources);
+		}
+
+		// Then listeners, once per property with its final value. What they set
+		// goes round again.
+		size_t end = pendingChanges.size();
+		for (; notified < end; notified++)
+		{
+			Property *prop = pendingChanges[notified];
+			if (!prop)
+				continue;
+			prop->queued = false;
+			prop->notify();
+		}
+	}
+
+	pendingChanges.clear();
+	batchDepth--;
+	flushing = false;
+}
+
+void Widget::render(Box boundingBox, Renderer &renderer)
+{
+	renderer.rect(boundingBox, Color(255, 255, 255));
+
+	for (const auto &c : children)
+	{
+		const Box &box = c->layoutBox;
+		c->paint(Box(boundingBox.x + box.x, boundingBox.y + box.y, box.w, box.h), renderer);
+	}
+}
+
+void Widget::paint(Box boundingBox, Renderer &renderer)
+{
+	NGUI_PROFILE_SCOPE(tag.empty() ? std::string_view("Widget") : tag);
+
+	if (window && (!indexed || boundingBox != lastBox))
+		window->reindex(this, boundingBox);
+	lastBox = boundingBox;
+	dirty = false;
+
+	if (!renderer.visible(boundingBox))
+		return;
+
+	if (clip)
+		renderer.pushClip(boundingBox);
+
+	if (!((layerWanted || layerAuto || shouldPromote()) && paintLayer(boundingBox, renderer)))
+		render(boundingBox, renderer);
+
+	if (clip)
+		renderer.popClip();
+}
+
+namespace
+{
+
+// Unchanged repaints before a subtree is worth caching, and how big it has to be
+constexpr unsigned autoLayerPaints = 30;
+constexpr size_t autoLayerWidgets = 16;
+
+}
+
+bool Widget::shouldPromote()
+{
+	if (++stablePaints != autoLayerPaints || !parent || !window)
+		return false;
+
+	// Not inside another layer, which already caches this
+	for (Widget *w = parent; w; w = w->parent)
+	{
+		if (w->layer)
+			return false;
+	}
+
+	size_t count = 0;
+	std::vector<const Widget *> pending = {this};
+	while (!pending.empty() && count < autoLayerWidgets)
+	{
+		const Widget *w = pending.back();
+		pending.pop_back();
+		count++;
+		pending.insert(pending.end(), w->children.begin(), w->children.end());
+	}
+
+	layerAuto = count >= autoLayerWidgets;
+	return layerAuto;
+}
+
+bool Widget::paintLayer(Box boundingBox, Renderer &renderer)
+{
+	if (!window)
+		return false;
+
+	Size size = {boundingBox.w, boundingBox.h};
+	if (!layer || layer.getSize() != size)
+	{
+		dropLayer();
+		layer = renderer.createTarget(size);
+		if (!layer)
+		{
+			layerAuto = false;
+			return false;
+		}
+		layerDirty = true;
+		window->addLayer(this);
+	}
+	else
+	{
+		window->touchLayer(this);
+	}
+
+	// Moving re-renders too, so everything inside knows where it was drawn
+	if (layerDirty || boundingBox != layerBox)
+	{
+		NGUI_PROFILE_SCOPE("layer render");
+		renderer.beginLayer(layer, Point{boundingBox.x, boundingBox.y});
+		render(boundingBox, renderer);
+		renderer.endLayer();
+
+		layerDirty = false;
+		layerBox = boundingBox;
+	}
+
+	renderer.texture(layer, boundingBox);
+	return true;
+}
+
+void Widget::dropLayer()
+{
+	if (!layer)
+		return;
+
+	if (window)
+		window->removeLayer(this);
+	layer = Texture();
+}
+
+void Widget::invalidate()
+{
+	dirty = true;
+	contentChanged();
+	if (window)
+		window->damage(lastBox);
+}
+
+void Widget::contentChanged()
+{
+	for (Widget *w = this; w; w = w->parent)
+	{
+		w->stablePaints = 0;
+		w->layerDirty = true;
+
+		// Automatic layers are for things that don't change, this one does
+		if (w->layerAuto)
+		{
+			w->layerAuto = false;
+			w->dropLayer();
+		}
+	}
+}
+
+void Widget::share(const std::string &key, const Property &value)
+{
+	Property &prop = property(key);
+	prop.share(value);
+	propertyChanged(key, prop);
+}
+
+void Widget::adopt(Widget *child)
+{
+	child->parent = this;
+	child->childIndex = children.size();
+	children.push_back(child);
+
+	if (window)
+		child->attach(window);
+
+	// The new child hasn't been drawn anywhere yet, so repaint where it'll go
+	invalidate();
+	invalidateLayout();
+}
+
+void Widget::removeChild(Widget *child)
+{
+	auto it = std::find(children.begin(), children.end(), child);
+	if (it == children.end())
+		return;
+
+	// Repaint where it was
+	child->invalidate();
+
+	children.erase(it);
+	for (size_t i = child->childIndex; i < children.size(); i++)
+		children[i]->childIndex = i;
+
+	child->parent = nullptr;
+	child->detach();
+	invalidateLayout();
+}
+
+void Widget::detach()
+{
+	dropLayer();
+	if (window)
+		window->forget(this);
+	window = nullptr;
+
+	for (Widget *child : children)
+		child->detach();
+}
+
+Widget::~Widget()
+{
+	dropLayer();
+	if (window)
+		window->forget(this);
+
+	// During an arena teardown its own widgets are destructed by the arena
+	bool bulk = arena && arena->tearingDown;
+	for (Widget *child : children)
+	{
+		// Already on its way out of children, destroy() needn't remove it
+		child->parent = nullptr;
+		if (!bulk || child->arena != arena)
+			destroy(child);
+	}
+}
+
+void Widget::destroy(Widget *widget)
+{
+	// Or the parent would be left pointing at it
+	if (widget->parent)
+		widget->parent->removeChild(widget);
+
+	WidgetArena *arena = widget->arena;
+	if (!arena)
+		delete widget;
+	else if (arena->root() == widget && !arena->tearingDown)
+		delete arena;
+	else
+		arena->release(widget);
+}
+
+WidgetArena::~WidgetArena()
+{
+	// Parents go before their children, so they can still tell which children
+	// came from other arenas and need destroying themselves. Once slots have
+	// been reused that's no longer slot order, so go by when each was created.
+	tearingDown = true;
+
+	std::vector<size_t> order;
+	if (reused)
+	{
+		order.resize(widgets.size());
+		std::iota(order.begin(), order.end(), size_t(0));
+		std::sort(order.begin(), order.end(), [this](size_t a, size_t b)
+		{
+			return widgets[a].serial < widgets[b].serial;
+		});
+	}
+
+	for (size_t i = 0; i < widgets.size(); i++)
+	{
+		// Checked each time, since destructors can release widgets further on
+		if (Widget *widget = widgets[reused ? order[i] : i].widget)
+			widget->~Widget();
+	}
+}
+
+void *WidgetArena::allocate(size_t size, size_t align)
+{
+	constexpr size_t blockSize = 64 * 1024;
+
+	size = (size + grain - 1) / grain * grain;
+	if (align <= grain)
+	{
+		size_t bucket = size / grain;
+		if (bucket < freeMemory.size() && !freeMemory[bucket].empty())
+		{
+			void *memory = freeMemory[bucket].back();
+			freeMemory[bucket].pop_back();
+			return memory;
+		}
+		align = grain;
+	}
+
+	// Blocks are only as aligned as new[] makes them, so it's the address that
+	// gets rounded up, not the offset
+	auto padding = [align](const char *at)
+	{
+		uintptr_t address = reinterpret_cast<uintptr_t>(at);
+		return static_cast<size_t>(((address + align - 1) & ~uintptr_t(align - 1)) - address);
+	};
+
+	if (!blocks.empty())
+	{
+		Block &block = blocks.back();
+		size_t offset = used + padding(block.memory.get() + used);
+		if (offset + size <= block.size)
+		{
+			used = offset + size;
+			return block.memory.get() + offset;
+		}
+	}
+
+	// With room to round up for anything aligned more strictly than new[]
+	size_t capacity = std::max(blockSize, size + align - grain);
+	blocks.push_back(Block{std::unique_ptr<char[]>(new char[capacity]), capacity});
+	size_t offset = padding(blocks.back().memory.get());
+	used = offset + size;
+	return blocks.back().memory.get() + offset;
+}
+
+size_t WidgetArena::track(Widget *widget, void *memory, size_t size, size_t align)
+{
+	Slot slot = {widget, memory, align <= grain ? (size + grain - 1) / grain * grain : 0, created++};
+	if (freeSlots.empty())
+	{
+		widgets.push_back(slot);
+		return widgets.size() - 1;
+	}
+
+	size_t index = freeSlots.back();
+	freeSlots.pop_back();
+	widgets[index] = slot;
+	reused = true;
+	return index;
+}
+
+void WidgetArena::release(Widget *widget)
+{
+	size_t index = widget->arenaIndex;
+	Slot slot = widgets[index];
+	widgets[index].widget = nullptr;
+	widget->~Widget();
+
+	// Nothing is worth keeping once the whole arena is going
+	if (tearingDown)
+		return;
+
+	freeSlots.push_back(index);
+	if (slot.bytes)
+	{
+		size_t bucket = slot.bytes / grain;
+		if (freeMemory.size() <= bucket)
+			freeMemory.resize(bucket + 1);
+		freeMemory[bucket].push_back(slot.memory);
+	}
+}
+
+void Widget::invalidateLayout()
+{
+	// All the way up, since being dirty says nothing about the ancestors: a
+	// widget that's never arranged stays dirty under a parent that was
+	for (Widget *w = this; w; w = w->parent)
+	{
+		w->layoutDirty = true;
+		w->measureDirty = true;
+	}
+
+	if (window)
+		window->scheduleUpdate();
+}
+
+Size Widget::measure(Size available)
+{
+	if (!measureDirty && available == measuredFor)
+		return measured;
+
+	Size size = measureContent(available);
+	if (layout.width >= 0)
+		size.w = layout.width;
+	if (layout.height >= 0)
+		size.h = layout.height;
+
+	measured = size;
+	measuredFor = available;
+	measureDirty = false;
+	return size;
+}
+
+void Widget::arrange(Box box)
+{
+	bool resized = box.w != layoutBox.w || box.h != layoutBox.h;
+	if (box != layoutBox && window)
+	{
+		// Repaint where it was and where it's going
+		window->damage(lastBox);
+		if (parent)
+			parent->contentChanged();
+
+		Point origin = {box.x, box.y};
+		for (Widget *p = parent; p; p = p->parent)
+		{
+			origin.x += p->layoutBox.x;
+			origin.y += p->layoutBox.y;
+		}
+		window->damage(Box(origin, Size{box.w, box.h}));
+	}
+	layoutBox = box;
+
+	// Children are positioned relative to this, so moving doesn't affect them
+	if (!resized && !layoutDirty)
+		return;
+
+	arrangeContent(Size{box.w, box.h});
+	layoutDirty = false;
+}
+
+Size Widget::measureContent(Size available)
+{
+	bool row = layout.direction == Direction::Row;
+	int inner = std::max(0, (row ? available.w : available.h) - 2 * layout.padding);
+	int cross = std::max(0, (row ? available.h : available.w) - 2 * layout.padding);
+
+	int main = 0;
+	int across = 0;
+	for (const auto &c : children)
+	{
+		Size childSize = c->measure(row ? Size{inner, cross} : Size{cross, inner});
+		main += row ? childSize.w : childSize.h;
+		across = std::max(across, row ? childSize.h : childSize.w);
+	}
+
+	if (!children.empty())
+		main += layout.spacing * static_cast<int>(children.size() - 1);
+
+	main += 2 * layout.padding;
+	across += 2 * layout.padding;
+	return row ? Size{main, across} : Size{across, main};
+}
+
+void Widget::arrangeContent(Size size)
+{
+	if (children.empty())
+		return;
+
+	bool row = layout.direction == Direction::Row;
+	int pad = layout.padding;
+	int inner = std::max(0, (row ? size.w : size.h) - 2 * pad);
+	int cross = std::max(0, (row ? size.h : size.w) - 2 * pad);
+
+	// First pass sizes everything that doesn't grow, the rest share what's left
+	int used = layout.spacing * static_cast<int>(children.size() - 1);
+	int growTotal = 0;
+	for (const auto &c : children)
+	{
+		int fixed = row ? c->layout.width : c->layout.height;
+		if (fixed >= 0)
+			used += fixed;
+		else if (c->layout.grow > 0)
+			growTotal += c->layout.grow;
+		else
+		{
+			Size childSize = c->measure(row ? Size{inner, cross} : Size{cross, inner});
+			used += row ? childSize.w : childSize.h;
+		}
+	}
+
+	int leftover = std::max(0, inner - used);
+	int position = pad;
+	int grown = 0;
+	for (const auto &c : children)
+	{
+		const LayoutParams &params = c->layout;
+
+		int length = row ? params.width : params.height;
+		if (length < 0)
+		{
+			if (params.grow > 0)
+			{
+				// Hand out the rounding error to the last grower so nothing is left over
+				grown += params.grow;
+				int end = static_cast<int>(static_cast<long long>(leftover) * grown / growTotal);
+				int start = static_cast<int>(static_cast<long long>(leftover) * (grown - params.grow) / growTotal);
+				length = end - start;
+			}
+			else
+			{
+				Size childSize = c->measure(row ? Size{inner, cross} : Size{cross, inner});
+				length = row ? childSize.w : childSize.h;
+			}
+		}
+
+		int breadth = row ? params.height : params.width;
+		int offset = 0;
+		if (breadth < 0)
+		{
+			if (layout.align == Align::Stretch)
+				breadth = cross;
+			else
+			{
+				Size childSize = c->measure(row ? Size{length, cross} : Size{cross, length});
+				breadth = std::min(cross, row ? childSize.h : childSize.w);
+			}
+		}
+
+		if (layout.align == Align::Center)
+			offset = (cross - breadth) / 2;
+		else if (layout.align == Align::End)
+			offset = cross - breadth;
+
+		if (row)
+			c->arrange(Box(position, pad + offset, length, breadth));
+		else
+			c->arrange(Box(pad + offset, position, breadth, length));
+
+		position += length + layout.spacing;
+	}
+}
+
+void Widget::propertyChanged(const std::string &key, Property &prop)
+{
+	if (key == "layer")
+	{
+		layerWanted = prop.toBool();
+		if (!layerWanted)
+			dropLayer();
+		return;
+	}
+
+	if (key == "clip")
+	{
+		clip = prop.toBool();
+		return;
+	}
+
+	// Anything that isn't a number, like "auto", sizes from content
+	if (key == "width")
+		layout.width = prop.numeric() ? prop.toInt() : -1;
+	else if (key == "height")
+		layout.height = prop.numeric() ? prop.toInt() : -1;
+	else if (key == "padding")
+		layout.padding = prop.toInt();
+	else if (key == "spacing")
+		layout.spacing = prop.toInt();
+	else if (key == "grow")
+		layout.grow = prop.numeric() ? prop.toInt() : 1;
+	else if (key == "direction")
+		layout.direction = prop.index({"column", "row"}) == 1 ? Direction::Row : Direction::Column;
+	else if (key == "align")
+		layout.align = static_cast<Align>(prop.index({"stretch", "start", "center", "end"}, 0));
+	else
+		return;
+
+	invalidateLayout();
+}
+
+bool Widget::mouseEvent(const MouseEvent &event)
+{
+	return mouseHandler && mouseHandler(event);
+}
+
+bool Widget::keyEvent(const KeyEvent &event)
+{
+	return keyHandler && keyHandler(event);
+}
+
+void Widget::focus()
+{
+	if (window)
+		window->setFocus(this);
+}
+
+bool Widget::hasFocus() const
+{
+	return window && window->getFocus() == this;
+}
+
+bool Widget::isAbove(const Widget *other) const
+{
+	auto depth = [](const Widget *w)
+	{
+		int d = 0;
+		for (; w->parent; w = w->parent)
+			d++;
+		return d;
+	};
+
+	// Children are drawn after their parents, and later siblings after earlier ones
+	const Widget *a = this;
+	const Widget *b = other;
+	int depthA = depth(a);
+	int depthB = depth(b);
+	for (; depthA > depthB; depthA--)
+	{
+		a = a->parent;
+		if (a == b)
+			return true;
+	}
+	for (; depthB > depthA; depthB--)
+	{
+		b = b->parent;
+		if (b == a)
+			return false;
+	}
+
+	if (a == b)
+		return false;
+	while (a->parent != b->parent)
+	{
+		a = a->parent;
+		b = b->parent;
+	}
+	return a->childIndex > b->childIndex;
+}
+
+void Widget::bind(const std::string &key, Widget *source, const std::string &sourceKey)
+{
+	bindTo(key, {{source, sourceKey}}, [this, key](const std::vector<const Property *> &values)
+	{
+		share(key, *values[0]);
+	});
+}
+
+void Widget::unbind(const std::string &key)
+{
+	auto it = properties.find(key);
+	if (it != properties.end())
+		it->second.unbind();
+}
+
+void Widget::bindTo(const std::string &key, std::vector<BindingSource> sources,
+	std::function<void (const std::vector<const Property *> &)> update)
+{
+	auto binding = std::make_unique<Property::Binding>();
+	binding->update = std::move(update);
+	for (const auto &[widget, sourceKey] : sources)
+		binding->sources.push_back(&widget->property(sourceKey));
+
+	property(key).bind(std::move(binding));
+}
+
+void Widget::attach(Window *win)
+{
+	window = win;
 	for (const auto &c : children)
-		c->render(boundingBox, renderer);
+		c->attach(win);
 }
 
 } // ng::ui
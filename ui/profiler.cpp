@@ -0,0 +1,159 @@
+#include <profiler.h>
+
+#ifdef NGUI_PROFILER
+
+#include <algorithm>
+#include <cstdio>
+
+namespace ng::ui
+{
+
+namespace
+{
+
+// Events kept per thread before the oldest half is dropped
+constexpr size_t eventLimit = 1 << 20;
+// Frames kept for the overlay
+constexpr size_t frameLimit = 120;
+
+void writeEscaped(FILE *file, std::string_view text)
+{
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+			std::fputc('\\', file);
+		if (static_cast<unsigned char>(c) >= 0x20)
+			std::fputc(c, file);
+	}
+}
+
+}
+
+Profiler &Profiler::shared()
+{
+	static Profiler profiler;
+	return profiler;
+}
+
+Profiler::Thread &Profiler::thread()
+{
+	thread_local Thread *current = nullptr;
+	if (!current)
+	{
+		std::lock_guard<std::mutex> lock(threadsMutex);
+		current = &threads.emplace_back();
+		current->id = static_cast<unsigned>(threads.size());
+	}
+	return *current;
+}
+
+void Profiler::record(std::string_view name, uint64_t start, uint64_t end)
+{
+	if (!enabled.load(std::memory_order_relaxed))
+		return;
+
+	Thread &current = thread();
+	std::lock_guard<std::mutex> lock(current.mutex);
+	if (current.events.size() >= eventLimit)
+		current.events.erase(current.events.begin(), current.events.begin() + eventLimit / 2);
+	current.events.push_back({name, start, end});
+}
+
+void Profiler::frame(uint64_t start, uint64_t end)
+{
+	if (!enabled.load(std::memory_order_relaxed))
+		return;
+
+	Frame frame = {start, end, {}};
+	for (int i = 0; i < CounterCount; i++)
+	{
+		frame.counters[i] = counters[i].exchange(0, std::memory_order_relaxed);
+	}
+
+	history.push_back(frame);
+	if (history.size() > frameLimit)
+		history.pop_front();
+}
+
+bool Profiler::writeTrace(const char *path)
+{
+	FILE *file = std::fopen(path, "w");
+	if (!file)
+		return false;
+
+	static const char *const counterNames[CounterCount] = {"draw calls", "texture binds", "texture uploads", "tessellations"};
+
+	std::fputs("{\"traceEvents\":[\n", file);
+	bool first = true;
+
+	std::lock_guard<std::mutex> threadsLock(threadsMutex);
+	for (auto &thread : threads)
+	{
+		std::lock_guard<std::mutex> lock(thread.mutex);
+		for (const auto &event : thread.events)
+		{
+			std::fputs(first ? "" : ",\n", file);
+			first = false;
+
+			std::fputs("{\"name\":\"", file);
+			writeEscaped(file, event.name);
+			std::fprintf(file, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				thread.id, event.start / 1e3, (event.end - event.start) / 1e3);
+		}
+	}
+
+	// Counters show up as graphs above the threads
+	for (const auto &frame : history)
+	{
+		for (int i = 0; i < CounterCount; i++)
+		{
+			std::fputs(first ? "" : ",\n", file);
+			first = false;
+			std::fprintf(file, "{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"count\":%lu}}",
+				counterNames[i], frame.start / 1e3, frame.counters[i]);
+		}
+	}
+
+	std::fputs("\n]}\n", file);
+	return std::fclose(file) == 0;
+}
+
+void Profiler::clear()
+{
+	std::lock_guard<std::mutex> threadsLock(threadsMutex);
+	for (auto &thread : threads)
+	{
+		std::lock_guard<std::mutex> lock(thread.mutex);
+		thread.events.clear();
+	}
+	history.clear();
+}
+
+void Profiler::drawOverlay(Renderer &renderer, Box area) const
+{
+	const int barWidth = 2;
+	const int height = 64;
+	// Full height is two frames at 60 Hz
+	const double scale = height / 33.3;
+
+	Box panel(area.x + area.w - static_cast<int>(frameLimit) * barWidth - 8, area.y + 8,
+		static_cast<int>(frameLimit) * barWidth, height);
+	renderer.fill(panel, Color(0, 0, 0, 160));
+
+	int x = panel.x + panel.w - static_cast<int>(history.size()) * barWidth;
+	for (const auto &frame : history)
+	{
+		double ms = frame.milliseconds();
+		int bar = std::min(height, std::max(1, static_cast<int>(ms * scale)));
+		Color color = ms <= 16.7 ? Color(80, 200, 80) : Color(220, 70, 50);
+		renderer.fill(Box(x, panel.y + height - bar, barWidth, bar), color);
+		x += barWidth;
+	}
+
+	// 60 Hz budget
+	renderer.fill(Box(panel.x, panel.y + height - static_cast<int>(16.7 * scale), panel.w, 1), Color(255, 255, 255, 120));
+}
+
+}
+
+#endif
@@ -0,0 +1,448 @@
+#include <software.h>
+#include <profiler.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define NGUI_SSE2 1
+#endif
+
+namespace ng::ui
+{
+
+namespace
+{
+
+// Premultiplies and packs a color as ARGB8888
+uint32_t pack(Color color)
+{
+	uint32_t r = (color.r * color.a + 127) / 255;
+	uint32_t g = (color.g * color.a + 127) / 255;
+	uint32_t b = (color.b * color.a + 127) / 255;
+	return (uint32_t(color.a) << 24) | (r << 16) | (g << 8) | b;
+}
+
+// x * a / 255, rounded, for x and a in [0, 255]
+inline uint32_t mul255(uint32_t x, uint32_t a)
+{
+	uint32_t t = x * a + 128;
+	return (t + (t >> 8)) >> 8;
+}
+
+// Premultiplied source-over for a single pixel
+inline uint32_t blend(uint32_t src, uint32_t dst)
+{
+	uint32_t inv = 255 - (src >> 24);
+	uint32_t rb = mul255(dst & 0xff, inv) | (mul255((dst >> 16) & 0xff, inv) << 16);
+	uint32_t ag = mul255((dst >> 8) & 0xff, inv) << 8 | (mul255(dst >> 24, inv) << 24);
+	return src + (rb | ag);
+}
+
+#ifdef NGUI_SSE2
+// Same as blend() for four pixels at once
+inline __m128i blend4(__m128i src, __m128i dst)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi16(128);
+
+	// 255 - alpha, spread over the four 16 bit channels of each pixel
+	__m128i inv = _mm_sub_epi32(_mm_set1_epi32(255), _mm_srli_epi32(src, 24));
+	inv = _mm_or_si128(inv, _mm_slli_epi32(inv, 16));
+	__m128i invLo = _mm_unpacklo_epi32(inv, inv);
+	__m128i invHi = _mm_unpackhi_epi32(inv, inv);
+
+	__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero), invLo), round);
+	__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero), invHi), round);
+	lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+	hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+	return _mm_adds_epu8(src, _mm_packus_epi16(lo, hi));
+}
+#endif
+
+// Blends a span of n pixels from src over dst
+void blendSpan(uint32_t *__restrict dst, const uint32_t *__restrict src, int n)
+{
+	int i = 0;
+#ifdef NGUI_SSE2
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+		__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), blend4(s, d));
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = blend(src[i], dst[i]);
+}
+
+// Blends a single color over a span of n pixels
+void blendFill(uint32_t *dst, uint32_t color, int n)
+{
+	int i = 0;
+#ifdef NGUI_SSE2
+	__m128i s = _mm_set1_epi32(static_cast<int>(color));
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), blend4(s, d));
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = blend(color, dst[i]);
+}
+
+void fillSpan(uint32_t *dst, uint32_t color, int n)
+{
+	uint32_t alpha = color >> 24;
+	if (alpha == 255)
+		std::fill_n(dst, n, color);
+	else if (alpha > 0)
+		blendFill(dst, color, n);
+}
+
+}
+
+SoftwareRenderer::SoftwareRenderer(Size size)
+	: screen(size.w, size.h)
+	, target(&screen)
+{}
+
+Box SoftwareRenderer::visibleArea(Box box) const
+{
+	box = box.intersected(Box(Size{target->w, target->h}));
+	if (clipping)
+		box = box.intersected(clipBox);
+	return box;
+}
+
+void SoftwareRenderer::fill(Box at, Color color)
+{
+	at = translated(at);
+	Box area = visibleArea(at);
+	if (area.empty())
+		return;
+
+	NGUI_PROFILE_COUNT(DrawCalls, 1);
+
+	uint32_t packed = pack(color);
+	for (int y = area.y; y < area.y + area.h; y++)
+		fillSpan(target->row(y) + area.x, packed, area.w);
+}
+
+void SoftwareRenderer::rect(Box at, Color color)
+{
+	if (at.empty())
+		return;
+
+	// Four edges, without overlapping at the corners so alpha stays even. fill()
+	// moves them to the layer origin.
+	fill(Box(at.x, at.y, at.w, 1), color);
+	if (at.h > 1)
+		fill(Box(at.x, at.y + at.h - 1, at.w, 1), color);
+	if (at.h > 2)
+	{
+		fill(Box(at.x, at.y + 1, 1, at.h - 2), color);
+		if (at.w > 1)
+			fill(Box(at.x + at.w - 1, at.y + 1, 1, at.h - 2), color);
+	}
+}
+
+void SoftwareRenderer::line(Point a, Point b, Color color, int width)
+{
+	a = Point{a.x + offset.x, a.y + offset.y};
+	b = Point{b.x + offset.x, b.y + offset.y};
+	width = std::max(1, width);
+	int half = width / 2;
+
+	// Walks the major axis one pixel at a time, and every run of steps that
+	// stay on the same minor coordinate is one box width pixels across, so
+	// nothing is blended twice
+	bool steep = std::abs(b.y - a.y) > std::abs(b.x - a.x);
+	if (steep)
+	{
+		std::swap(a.x, a.y);
+		std::swap(b.x, b.y);
+	}
+	if (a.x > b.x)
+		std::swap(a, b);
+
+	int dx = b.x - a.x;
+	int dy = std::abs(b.y - a.y);
+	int step = a.y < b.y ? 1 : -1;
+	int error = dx / 2;
+	uint32_t packed = pack(color);
+	int runs = 0;
+
+	auto run = [&](int from, int to, int minor)
+	{
+		Box box = steep ? Box(minor - half, from, width, to - from) : Box(from, minor - half, to - from, width);
+		Box area = visibleArea(box);
+		if (area.empty())
+			return;
+
+		runs++;
+		for (int y = area.y; y < area.y + area.h; y++)
+			fillSpan(target->row(y) + area.x, packed, area.w);
+	};
+
+	int start = a.x;
+	int y = a.y;
+	for (int x = a.x; x <= b.x; x++)
+	{
+		error -= dy;
+		if (error < 0 && x < b.x)
+		{
+			run(start, x + 1, y);
+			start = x + 1;
+			y += step;
+			error += dx;
+		}
+	}
+	run(start, b.x + 1, y);
+
+	if (runs > 0)
+		NGUI_PROFILE_COUNT(DrawCalls, 1);
+}
+
+void SoftwareRenderer::curve(const Bezier &bezier, float width, Color color, float scale, SDL_FPoint origin)
+{
+	const CurveStrip &strip = tessellate(bezier, width, scale);
+	Box bounds(static_cast<int>(std::floor(origin.x + strip.left * scale)),
+		static_cast<int>(std::floor(origin.y + strip.top * scale)),
+		static_cast<int>(std::ceil((strip.right - strip.left) * scale)) + 2,
+		static_cast<int>(std::ceil((strip.bottom - strip.top) * scale)) + 2);
+	if (visibleArea(translated(bounds)).empty())
+		return;
+
+	// Lines along the middle of the strip rather than its triangles, close
+	// enough at the widths curves are drawn. Points a pixel or two apart would
+	// only redraw the same pixels, so they're skipped.
+	int pixels = std::max(1, static_cast<int>(width * scale + 0.5f));
+	const std::vector<SDL_FPoint> &points = strip.points;
+	Point previous = {0, 0};
+	for (size_t i = 0; i < points.size(); i += 2)
+	{
+		float x = origin.x + (points[i].x + points[i + 1].x) / 2 * scale;
+		float y = origin.y + (points[i].y + points[i + 1].y) / 2 * scale;
+		Point at = {static_cast<int>(std::floor(x)), static_cast<int>(std::floor(y))};
+		bool last = i + 2 >= points.size();
+		if (i > 0 && !last && std::abs(at.x - previous.x) + std::abs(at.y - previous.y) < 4)
+			continue;
+		if (i > 0)
+			line(previous, at, color, pixels);
+		previous = at;
+	}
+}
+
+void SoftwareRenderer::texture(const Texture &texture, Box at)
+{
+	if (const Pixmap *src = texture.pixmap.get())
+		this->texture(texture, Box(0, 0, src->w, src->h), at);
+}
+
+void SoftwareRenderer::texture(const Texture &texture, Box source, Box at, Color tint)
+{
+	const Pixmap *src = texture.pixmap.get();
+	if (!src || src == target)
+		return;
+
+	source = source.intersected(Box(0, 0, src->w, src->h));
+	if (source.empty())
+		return;
+
+	at = translated(at);
+	Box area = visibleArea(at);
+	if (area.empty())
+		return;
+
+	NGUI_PROFILE_COUNT(DrawCalls, 1);
+	NGUI_PROFILE_COUNT(TextureBinds, 1);
+
+	bool scaled = at.w != source.w || at.h != source.h;
+	bool tinted = tint != Color(255, 255, 255);
+	if (scaled)
+	{
+		// Nearest neighbour; the columns only depend on the destination box
+		columns.resize(area.w);
+		for (int x = 0; x < area.w; x++)
+			columns[x] = source.x + static_cast<int>((static_cast<long long>(area.x - at.x + x) * source.w) / at.w);
+	}
+	if (scaled || tinted)
+		scanline.resize(area.w);
+
+	// Premultiplied, like the pixels it scales
+	uint32_t tintA = tint.a;
+	uint32_t tintR = mul255(tint.r, tint.a);
+	uint32_t tintG = mul255(tint.g, tint.a);
+	uint32_t tintB = mul255(tint.b, tint.a);
+
+	for (int y = area.y; y < area.y + area.h; y++)
+	{
+		int sy = source.y + static_cast<int>((static_cast<long long>(y - at.y) * source.h) / at.h);
+		const uint32_t *srcRow = src->row(sy);
+		uint32_t *dst = target->row(y) + area.x;
+
+		if (scaled)
+		{
+			for (int x = 0; x < area.w; x++)
+				scanline[x] = srcRow[columns[x]];
+			srcRow = scanline.data();
+		}
+		else
+		{
+			srcRow += source.x + area.x - at.x;
+		}
+
+		if (tinted)
+		{
+			for (int x = 0; x < area.w; x++)
+			{
+				uint32_t p = srcRow[x];
+				scanline[x] = (mul255(p >> 24, tintA) << 24) | (mul255((p >> 16) & 0xff, tintR) << 16)
+					| (mul255((p >> 8) & 0xff, tintG) << 8) | mul255(p & 0xff, tintB);
+			}
+			srcRow = scanline.data();
+		}
+
+		if (src->opaque && tintA == 255)
+			std::memcpy(dst, srcRow, area.w * sizeof(uint32_t));
+		else
+			blendSpan(dst, srcRow, area.w);
+	}
+}
+
+Texture SoftwareRenderer::textureFromSurface(SDL_Surface *source)
+{
+	NGUI_PROFILE_SCOPE("texture upload");
+	NGUI_PROFILE_COUNT(TextureUploads, 1);
+
+	SDL_Surface *surface = SDL_ConvertSurfaceFormat(source, SDL_PIXELFORMAT_ARGB8888, 0);
+	if (!surface)
+		throw std::runtime_error("Could not convert image to ARGB8888");
+
+	auto pixmap = std::make_shared<Pixmap>(surface->w, surface->h);
+	pixmap->opaque = true;
+
+	SDL_LockSurface(surface);
+	for (int y = 0; y < surface->h; y++)
+	{
+		auto *src = reinterpret_cast<const uint32_t *>(static_cast<const char *>(surface->pixels) + y * surface->pitch);
+		uint32_t *dst = pixmap->row(y);
+		for (int x = 0; x < surface->w; x++)
+		{
+			uint32_t p = src[x];
+			uint32_t a = p >> 24;
+			if (a != 255)
+			{
+				pixmap->opaque = false;
+				p = (a << 24) | (mul255((p >> 16) & 0xff, a) << 16) | (mul255((p >> 8) & 0xff, a) << 8) | mul255(p & 0xff, a);
+			}
+			dst[x] = p;
+		}
+	}
+	SDL_UnlockSurface(surface);
+	SDL_FreeSurface(surface);
+
+	return Texture(std::move(pixmap));
+}
+
+Texture SoftwareRenderer::textureFromPremultiplied(SDL_Surface *source)
+{
+	NGUI_PROFILE_SCOPE("texture upload");
+	NGUI_PROFILE_COUNT(TextureUploads, 1);
+
+	if (source->format->format != SDL_PIXELFORMAT_ARGB8888)
+		throw std::runtime_error("Premultiplied images must be ARGB8888");
+
+	auto pixmap = std::make_shared<Pixmap>(source->w, source->h);
+	uint32_t alpha = 0xff000000;
+
+	SDL_LockSurface(source);
+	for (int y = 0; y < source->h; y++)
+	{
+		auto *src = reinterpret_cast<const uint32_t *>(static_cast<const char *>(source->pixels) + y * source->pitch);
+		uint32_t *dst = pixmap->row(y);
+		std::memcpy(dst, src, source->w * sizeof(uint32_t));
+		for (int x = 0; x < source->w; x++)
+			alpha &= dst[x];
+	}
+	SDL_UnlockSurface(source);
+
+	pixmap->opaque = alpha == 0xff000000;
+	return Texture(std::move(pixmap));
+}
+
+void SoftwareRenderer::clear(Color color)
+{
+	std::fill(target->pixels.begin(), target->pixels.end(), pack(color));
+	target->opaque = color.a == 255;
+}
+
+void SoftwareRenderer::present()
+{
+	frames++;
+	endFrame();
+}
+
+void SoftwareRenderer::flush()
+{
+	// Everything is drawn immediately
+}
+
+void SoftwareRenderer::setClip(const Box *clip)
+{
+	clipping = clip != nullptr;
+	if (clipping)
+		clipBox = *clip;
+}
+
+Texture SoftwareRenderer::createTarget(Size size)
+{
+	return Texture(std::make_shared<Pixmap>(size.w, size.h));
+}
+
+void SoftwareRenderer::setTarget(const Texture &texture)
+{
+	if (!texture.pixmap)
+		return resetTarget();
+
+	activeTarget = texture;
+	targetTexture = texture.pixmap;
+	target = targetTexture.get();
+}
+
+void SoftwareRenderer::resetTarget()
+{
+	activeTarget = Texture();
+	targetTexture.reset();
+	target = &screen;
+}
+
+Size SoftwareRenderer::outputSize()
+{
+	return Size{screen.w, screen.h};
+}
+
+void SoftwareRenderer::resize(Size size)
+{
+	screen = Pixmap(size.w, size.h);
+}
+
+bool SoftwareRenderer::savePNG(const char *path) const
+{
+	// Saved as is, so translucent areas come out premultiplied
+	SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormatFrom(const_cast<uint32_t *>(screen.pixels.data()),
+		screen.w, screen.h, 32, screen.w * 4, SDL_PIXELFORMAT_ARGB8888);
+	if (!surface)
+		return false;
+
+	bool saved = IMG_SavePNG(surface, path) == 0;
+	SDL_FreeSurface(surface);
+	return saved;
+}
+
+}
@@ -0,0 +1,375 @@
+#include <text.h>
+#include <profiler.h>
+#include <SDL2/SDL_ttf.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <map>
+
+namespace ng::ui
+{
+
+namespace
+{
+
+// Width and height of an atlas page, unless a glyph needs more
+constexpr int pageSize = 512;
+// Pages the atlas grows to before it starts over
+constexpr size_t maxPages = 8;
+// Transparent pixels between glyphs, so filtering never bleeds into a neighbour
+constexpr int glyphPadding = 1;
+
+std::map<std::pair<std::string, int>, std::weak_ptr<Font>> openFonts;
+uint32_t nextFontId = 1;
+
+// Glyphs past U+FFFF need the 32-bit functions from SDL_ttf 2.0.18. Older
+// versions only get the basic multilingual plane, with U+FFFD for the rest.
+#if SDL_TTF_VERSION_ATLEAST(2, 0, 18)
+int kerning(TTF_Font *font, uint32_t previous, uint32_t codepoint)
+{
+	return TTF_GetFontKerningSizeGlyphs32(font, previous, codepoint);
+}
+
+SDL_Surface *renderGlyph(TTF_Font *font, uint32_t codepoint)
+{
+	return TTF_RenderGlyph32_Blended(font, codepoint, SDL_Color{255, 255, 255, 255});
+}
+
+int glyphAdvance(TTF_Font *font, uint32_t codepoint, int &advance)
+{
+	return TTF_GlyphMetrics32(font, codepoint, nullptr, nullptr, nullptr, nullptr, &advance);
+}
+#else
+Uint16 narrow(uint32_t codepoint)
+{
+	return codepoint > 0xffff ? 0xfffd : static_cast<Uint16>(codepoint);
+}
+
+int kerning(TTF_Font *font, uint32_t previous, uint32_t codepoint)
+{
+	return TTF_GetFontKerningSizeGlyphs(font, narrow(previous), narrow(codepoint));
+}
+
+SDL_Surface *renderGlyph(TTF_Font *font, uint32_t codepoint)
+{
+	return TTF_RenderGlyph_Blended(font, narrow(codepoint), SDL_Color{255, 255, 255, 255});
+}
+
+int glyphAdvance(TTF_Font *font, uint32_t codepoint, int &advance)
+{
+	return TTF_GlyphMetrics(font, narrow(codepoint), nullptr, nullptr, nullptr, nullptr, &advance);
+}
+#endif
+
+// The codepoint starting at text[i], moving i past it. Malformed sequences come out as U+FFFD.
+uint32_t decode(const std::string &text, size_t &i)
+{
+	unsigned char lead = text[i++];
+	if (lead < 0x80)
+		return lead;
+
+	int length = lead >= 0xf0 ? 3 : lead >= 0xe0 ? 2 : lead >= 0xc0 ? 1 : 0;
+	if (length == 0 || i + length > text.size())
+		return 0xfffd;
+
+	uint32_t codepoint = lead & (0x3f >> length);
+	for (int n = 0; n < length; n++)
+	{
+		unsigned char next = text[i];
+		if ((next & 0xc0) != 0x80)
+			return 0xfffd;
+		codepoint = (codepoint << 6) | (next & 0x3f);
+		i++;
+	}
+	return codepoint;
+}
+
+uint64_t glyphKey(const Font &font, uint32_t codepoint)
+{
+	return (static_cast<uint64_t>(font.getId()) << 32) | codepoint;
+}
+
+}
+
+Font::Font(TTF_Font *font, int size)
+	: font(font)
+	, size(size)
+	, lineSkip(TTF_FontLineSkip(font))
+	, id(nextFontId++)
+{}
+
+Font::~Font()
+{
+	// After TTF_Quit() the font has already gone with the library
+	if (TTF_WasInit())
+		TTF_CloseFont(font);
+}
+
+std::shared_ptr<Font> Font::get(const std::string &path, int size)
+{
+	auto key = std::make_pair(path, size);
+	if (auto font = openFonts[key].lock())
+		return font;
+
+	TTF_Font *opened = TTF_OpenFont(path.c_str(), size);
+	if (!opened)
+	{
+		openFonts.erase(key);
+		return nullptr;
+	}
+
+	std::shared_ptr<Font> font(new Font(opened, size));
+	openFonts[key] = font;
+	return font;
+}
+
+std::shared_ptr<const TextRun> Font::layout(const std::string &text)
+{
+	auto it = runs.find(text);
+	if (it != runs.end())
+	{
+		recent.splice(recent.begin(), recent, it->second.recent);
+		return it->second.run;
+	}
+
+	NGUI_PROFILE_SCOPE("Font::layout");
+	layouts++;
+
+	auto run = std::make_shared<TextRun>();
+	int x = 0;
+	int y = 0;
+	int width = 0;
+	uint32_t previous = 0;
+	for (size_t i = 0; i < text.size();)
+	{
+		uint32_t codepoint = decode(text, i);
+		if (codepoint == '\n')
+		{
+			width = std::max(width, x);
+			x = 0;
+			y += lineSkip;
+			previous = 0;
+			continue;
+		}
+
+		if (previous)
+			x += kerning(font, previous, codepoint);
+		run->glyphs.push_back(TextRun::Glyph{codepoint, x, y});
+		x += advance(codepoint);
+		previous = codepoint;
+	}
+	run->size = Size{std::max(width, x), y + TTF_FontHeight(font)};
+
+	recent.push_front(text);
+	runs.emplace(text, Run{run, recent.begin()});
+	while (runs.size() > runBudget)
+	{
+		runs.erase(recent.back());
+		recent.pop_back();
+	}
+
+	return run;
+}
+
+SDL_Surface *Font::rasterize(uint32_t codepoint)
+{
+	NGUI_PROFILE_SCOPE("Font::rasterize");
+	return renderGlyph(font, codepoint);
+}
+
+int Font::advance(uint32_t codepoint)
+{
+	auto it = advances.find(codepoint);
+	if (it != advances.end())
+		return it->second;
+
+	int advance = 0;
+	if (glyphAdvance(font, codepoint, advance) != 0)
+		advance = 0;
+	advances.emplace(codepoint, advance);
+	return advance;
+}
+
+GlyphAtlas::GlyphAtlas() = default;
+
+GlyphAtlas::~GlyphAtlas()
+{
+	clear();
+}
+
+const GlyphAtlas::Glyph &GlyphAtlas::find(Font &font, uint32_t codepoint)
+{
+	uint64_t key = glyphKey(font, codepoint);
+	auto it = glyphs.find(key);
+	if (it != glyphs.end())
+		return it->second;
+
+	Glyph glyph = {0, Box(), Point{0, 0}};
+	SDL_Surface *rendered = font.rasterize(codepoint);
+	SDL_Surface *surface = rendered ? SDL_ConvertSurfaceFormat(rendered, SDL_PIXELFORMAT_ARGB8888, 0) : nullptr;
+	if (rendered)
+		SDL_FreeSurface(rendered);
+
+	if (surface)
+	{
+		SDL_LockSurface(surface);
+		auto row = [&](int y)
+		{
+			return reinterpret_cast<const uint32_t *>(static_cast<const char *>(surface->pixels) + y * surface->pitch);
+		};
+
+		// Only the part with any coverage goes in the atlas, glyphs come
+		// back the height of the whole line
+		int left = surface->w, top = surface->h, right = -1, bottom = -1;
+		for (int y = 0; y < surface->h; y++)
+		{
+			for (int x = 0; x < surface->w; x++)
+			{
+				if (row(y)[x] >> 24)
+				{
+					left = std::min(left, x);
+					right = std::max(right, x);
+					top = std::min(top, y);
+					bottom = std::max(bottom, y);
+				}
+			}
+		}
+
+		if (right >= 0)
+		{
+			int w = right - left + 1;
+			int h = bottom - top + 1;
+			glyph = place(w, h);
+			glyph.offset = Point{left, top};
+
+			Page &page = pages[glyph.page];
+			for (int y = 0; y < h; y++)
+			{
+				auto *dst = reinterpret_cast<uint32_t *>(static_cast<char *>(page.pixels->pixels)
+					+ (glyph.source.y + y) * page.pixels->pitch) + glyph.source.x;
+				std::memcpy(dst, row(top + y) + left, w * sizeof(uint32_t));
+			}
+			page.dirty = true;
+		}
+
+		SDL_UnlockSurface(surface);
+		SDL_FreeSurface(surface);
+	}
+
+	return glyphs.emplace(key, glyph).first->second;
+}
+
+const Texture &GlyphAtlas::page(Renderer &renderer, int index)
+{
+	Page &page = pages[index];
+	if (page.dirty)
+	{
+		// A new texture rather than an update, so anything already recorded
+		// with the old one still draws what it was recorded with
+		page.texture = renderer.textureFromSurface(page.pixels);
+		page.dirty = false;
+	}
+	return page.texture;
+}
+
+void GlyphAtlas::trim()
+{
+	if (pages.size() > maxPages)
+		clear();
+}
+
+GlyphAtlas::Glyph GlyphAtlas::place(int w, int h)
+{
+	int paddedW = w + glyphPadding;
+	int paddedH = h + glyphPadding;
+
+	if (!pages.empty())
+	{
+		Page &page = pages.back();
+		if (page.x + paddedW > page.pixels->w)
+		{
+			page.shelfY += page.shelfHeight;
+			page.shelfHeight = 0;
+			page.x = 0;
+		}
+
+		if (page.x + paddedW <= page.pixels->w && page.shelfY + paddedH <= page.pixels->h)
+		{
+			Glyph glyph = {static_cast<int>(pages.size() - 1), Box(page.x, page.shelfY, w, h), Point{0, 0}};
+			page.x += paddedW;
+			page.shelfHeight = std::max(page.shelfHeight, paddedH);
+			return glyph;
+		}
+	}
+
+	int side = std::max({pageSize, paddedW, paddedH});
+	SDL_Surface *pixels = SDL_CreateRGBSurfaceWithFormat(0, side, side, 32, SDL_PIXELFORMAT_ARGB8888);
+	if (!pixels)
+		throw std::runtime_error("Could not create glyph atlas page");
+
+	pages.push_back(Page{pixels, Texture(), true, 0, paddedH, paddedW});
+	return Glyph{static_cast<int>(pages.size() - 1), Box(0, 0, w, h), Point{0, 0}};
+}
+
+void GlyphAtlas::clear()
+{
+	for (Page &page : pages)
+		SDL_FreeSurface(page.pixels);
+	pages.clear();
+	glyphs.clear();
+}
+
+void Label::render(Box boundingBox, Renderer &renderer)
+{
+	if (run && font)
+		renderer.text(*font, *run, Point{boundingBox.x, boundingBox.y}, color);
+}
+
+Size Label::measureContent(Size available)
+{
+	return run ? run->size : Size{0, 0};
+}
+
+void Label::propertyChanged(const std::string &key, Property &prop)
+{
+	if (key == "text")
+		text = prop.toString();
+	else if (key == "font")
+		fontPath = prop.toString();
+	else if (key == "fontSize")
+		fontSize = std::max(1, prop.toInt());
+	else if (key == "color")
+	{
+		color = prop.toColor();
+		return;
+	}
+	else
+	{
+		Widget::propertyChanged(key, prop);
+		return;
+	}
+
+	if (key != "text")
+		font.reset();
+	relayout();
+}
+
+void Label::relayout()
+{
+	Size before = run ? run->size : Size{0, 0};
+
+	if (!font && !fontPath.empty())
+	{
+		font = Font::get(fontPath, fontSize);
+		if (!font)
+			std::cerr << "Could not load font from path '" << fontPath << "'" << std::endl;
+	}
+
+	run = font ? font->layout(text) : nullptr;
+
+	Size after = run ? run->size : Size{0, 0};
+	if (after != before)
+		invalidateLayout();
+}
+
+}
@@ -0,0 +1,163 @@
+#include <watcher.h>
+#include <worker.h>
+#include <vector>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace ng::ui
+{
+
+#ifdef __linux__
+
+namespace
+{
+
+// Splits a path into its directory and file name
+std::pair<std::string, std::string> splitPath(const std::string &path)
+{
+	size_t slash = path.rfind('/');
+	if (slash == std::string::npos)
+		return {".", path};
+	return {slash == 0 ? "/" : path.substr(0, slash), path.substr(slash + 1)};
+}
+
+}
+
+FileWatcher::FileWatcher()
+{
+	inotify = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if (inotify < 0 || pipe(stopPipe) != 0)
+		return;
+
+	thread = std::thread(&FileWatcher::run, this);
+}
+
+FileWatcher::~FileWatcher()
+{
+	if (thread.joinable())
+	{
+		char stop = 0;
+		(void)!write(stopPipe[1], &stop, 1);
+		thread.join();
+	}
+
+	for (int fd : {inotify, stopPipe[0], stopPipe[1]})
+	{
+		if (fd >= 0)
+			close(fd);
+	}
+}
+
+void FileWatcher::watch(const std::string &path, std::function<void ()> changed)
+{
+	if (inotify < 0)
+		return;
+
+	auto [dir, file] = splitPath(path);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = directories.find(dir);
+	if (it == directories.end())
+	{
+		int descriptor = inotify_add_watch(inotify, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+		if (descriptor < 0)
+			return;
+		it = directories.emplace(dir, Directory{descriptor, {}}).first;
+	}
+
+	it->second.files[file] = std::make_shared<std::function<void ()>>(std::move(changed));
+}
+
+void FileWatcher::unwatch(const std::string &path)
+{
+	auto [dir, file] = splitPath(path);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = directories.find(dir);
+	if (it == directories.end())
+		return;
+
+	it->second.files.erase(file);
+	if (it->second.files.empty())
+	{
+		inotify_rm_watch(inotify, it->second.descriptor);
+		directories.erase(it);
+	}
+}
+
+void FileWatcher::run()
+{
+	alignas(inotify_event) char buffer[4096];
+
+	while (true)
+	{
+		pollfd fds[2] = {{inotify, POLLIN, 0}, {stopPipe[0], POLLIN, 0}};
+		if (poll(fds, 2, -1) < 0)
+			continue;
+		if (fds[1].revents)
+			return;
+
+		// Everything that's queued up now counts as one change per file
+		std::vector<std::weak_ptr<std::function<void ()>>> changed;
+		ssize_t length;
+		while ((length = read(inotify, buffer, sizeof(buffer))) > 0)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (char *at = buffer; at < buffer + length;)
+			{
+				auto *event = reinterpret_cast<inotify_event *>(at);
+				at += sizeof(inotify_event) + event->len;
+				if (event->len == 0)
+					continue;
+
+				for (auto &[dir, directory] : directories)
+				{
+					if (directory.descriptor != event->wd)
+						continue;
+
+					auto file = directory.files.find(event->name);
+					if (file == directory.files.end())
+						continue;
+
+					bool seen = false;
+					for (auto &weak : changed)
+						seen = seen || weak.lock() == file->second;
+					if (!seen)
+						changed.push_back(file->second);
+				}
+			}
+		}
+
+		for (auto &weak : changed)
+		{
+			// Dropped if the file is unwatched before the UI thread gets to it
+			WorkerPool::shared().post([weak]
+			{
+				if (auto callback = weak.lock())
+					(*callback)();
+			});
+		}
+	}
+}
+
+#else
+
+FileWatcher::FileWatcher() = default;
+FileWatcher::~FileWatcher() = default;
+
+void FileWatcher::watch(const std::string &, std::function<void ()>)
+{}
+
+void FileWatcher::unwatch(const std::string &)
+{}
+
+void FileWatcher::run()
+{}
+
+#endif
+
+}
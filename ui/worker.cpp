@@ -0,0 +1,92 @@
+#include <worker.h>
+
+namespace ng::ui
+{
+
+WorkerPool &WorkerPool::shared()
+{
+	static WorkerPool pool;
+	return pool;
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		jobs.clear();
+	}
+	available.notify_all();
+
+	for (auto &thread : threads)
+		thread.join();
+}
+
+void WorkerPool::submit(std::function<void ()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (threads.empty())
+		{
+			// Leave a core for the UI thread
+			unsigned count = std::thread::hardware_concurrency();
+			count = count > 2 ? count - 1 : 1;
+			for (unsigned i = 0; i < count; i++)
+				threads.emplace_back(&WorkerPool::work, this);
+		}
+		jobs.push_back(std::move(job));
+	}
+	available.notify_one();
+}
+
+void WorkerPool::post(std::function<void ()> task)
+{
+	std::function<void ()> wake;
+	{
+		std::lock_guard<std::mutex> lock(postedMutex);
+		posted.push_back(std::move(task));
+		wake = wakeup;
+	}
+
+	if (wake)
+		wake();
+}
+
+void WorkerPool::runPosted()
+{
+	std::vector<std::function<void ()>> tasks;
+	{
+		std::lock_guard<std::mutex> lock(postedMutex);
+		tasks.swap(posted);
+	}
+
+	for (auto &task : tasks)
+		task();
+}
+
+void WorkerPool::setWakeup(std::function<void ()> wake)
+{
+	std::lock_guard<std::mutex> lock(postedMutex);
+	wakeup = std::move(wake);
+}
+
+void WorkerPool::work()
+{
+	while (true)
+	{
+		std::function<void ()> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			available.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if (stopping)
+				return;
+
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+
+		job();
+	}
+}
+
+}